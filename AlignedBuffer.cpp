@@ -0,0 +1,74 @@
+/*
+AlignedBuffer
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "AlignedBuffer.h"
+#include <atomic>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Size and alignment of a transparent huge page on x86-64 and arm64 Linux
+#define HUGE_PAGE (2 << 20)
+
+static std::atomic<size_t> InUse(0);
+static std::atomic<size_t> Peak(0);
+
+void *Aligned_Alloc(size_t bytes)
+{
+   const size_t alignment = bytes >= HUGE_PAGE ? HUGE_PAGE : BUFFER_ALIGNMENT;
+   if (bytes == 0) bytes = 1;
+#ifdef _WIN32
+   void *p = _aligned_malloc(bytes, alignment);
+#else
+   void *p = 0;
+   if (posix_memalign(&p, alignment, bytes) != 0) p = 0;
+#endif
+   if (!p) throw std::bad_alloc();
+#if defined(PDIFF_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+   // Only whole huge pages of the buffer, the rest may hold other data
+   if (alignment == HUGE_PAGE) madvise(p, bytes & ~(size_t) (HUGE_PAGE - 1), MADV_HUGEPAGE);
+#endif
+
+   const size_t in_use = InUse += bytes;
+   size_t peak = Peak;
+   while (in_use > peak && !Peak.compare_exchange_weak(peak, in_use)) {}
+   return p;
+}
+
+void Aligned_Free(void *p, size_t bytes)
+{
+   if (!p) return;
+   InUse -= bytes ? bytes : 1;
+#ifdef _WIN32
+   _aligned_free(p);
+#else
+   free(p);
+#endif
+}
+
+size_t Buffer_Memory_In_Use()
+{
+   return InUse;
+}
+
+size_t Buffer_Memory_Peak()
+{
+   return Peak;
+}
@@ -0,0 +1,72 @@
+/*
+AlignedBuffer
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#ifndef _ALIGNEDBUFFER_H
+#define _ALIGNEDBUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <vector>
+
+// Alignment of all working memory: a cache line, so rows start on one and
+// no SIMD load straddles two
+#define BUFFER_ALIGNMENT 64
+
+// Working memory of the comparisons: pyramid levels, tile buffers, float
+// images and the reference cache. Buffers of 2 MiB or more are aligned to
+// 2 MiB and, when built with PDIFF_HUGE_PAGES on Linux, offered to the
+// kernel as transparent huge pages, which saves TLB misses on large images.
+// The bytes held are counted over the whole process along with their
+// high-water mark. Aligned_Alloc throws std::bad_alloc when out of memory.
+void *Aligned_Alloc(size_t bytes);
+void Aligned_Free(void *p, size_t bytes);
+size_t Buffer_Memory_In_Use();
+size_t Buffer_Memory_Peak();
+
+// Shared owner of n elements of T from Aligned_Alloc, left uninitialized
+template <typename T>
+std::shared_ptr<T> Aligned_Shared(size_t n)
+{
+   const size_t bytes = n * sizeof(T);
+   return std::shared_ptr<T>(static_cast<T *>(Aligned_Alloc(bytes)),
+      [bytes](T *p) { Aligned_Free(p, bytes); });
+}
+
+// Allocator for standard containers of working memory
+template <typename T>
+class AlignedAllocator
+{
+public:
+   typedef T value_type;
+
+   AlignedAllocator() {}
+   template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+   T *allocate(size_t n) { return static_cast<T *>(Aligned_Alloc(n * sizeof(T))); }
+   void deallocate(T *p, size_t n) { Aligned_Free(p, n * sizeof(T)); }
+
+   template <typename U> struct rebind { typedef AlignedAllocator<U> other; };
+   template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+   template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float> > AlignedFloats;
+typedef std::vector<uint16_t, AlignedAllocator<uint16_t> > AlignedHalves;
+
+#endif
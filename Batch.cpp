@@ -0,0 +1,156 @@
+/*
+Batch
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "Batch.h"
+#include "CompareArgs.h"
+#include "Metric.h"
+#include "RGBAImage.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BatchPair
+{
+   std::vector<std::string> Tokens;   // expected result, images and options
+   int Line;
+   std::string Result;
+   unsigned int PixelsFailed;
+   double Milliseconds;
+   std::string ImgA, ImgB;
+   bool Done;
+};
+
+static void Compare_Pair(const std::vector<std::string> &common, BatchPair &pair)
+{
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   // Rebuild a command line for Parse_Args; verbose output would be
+   // interleaved between the pairs and is dropped
+   std::vector<std::string> tokens(common);
+   tokens.insert(tokens.end(), pair.Tokens.begin() + 1, pair.Tokens.end());
+   // Each pair runs on one thread, decoding included
+   tokens.push_back("-threads");
+   tokens.push_back("1");
+   std::vector<char *> argv;
+   for (size_t i = 0; i < tokens.size(); i++) {
+      if (tokens[i] != "-verbose") argv.push_back(&tokens[i][0]);
+   }
+   argv.push_back(0);
+
+   // Until the images are loaded their names are the first two words
+   pair.ImgA = pair.Tokens.size() > 1 ? pair.Tokens[1] : "-";
+   pair.ImgB = pair.Tokens.size() > 2 ? pair.Tokens[2] : "-";
+
+   CompareArgs args;
+   bool parsed = false;
+   if (pair.Tokens[0] == "PASS" || pair.Tokens[0] == "FAIL") {
+      parsed = args.Parse_Args((int) argv.size() - 1, &argv[0]);
+      fprintf(stderr, "%s", args.Warnings.c_str());
+   }
+   if (pair.Tokens[0] != "PASS" && pair.Tokens[0] != "FAIL") {
+      pair.Result = "ERROR";
+      fprintf(stderr, "Line %d: expected result must be PASS or FAIL\n", pair.Line);
+   } else if (!parsed || !args.Load_Images()) {
+      pair.Result = "ERROR";
+      fprintf(stderr, "Line %d: %s", pair.Line, args.ErrorStr.c_str());
+   } else {
+      pair.Result = Yee_Compare(args) ? "PASS" : "FAIL";
+      pair.PixelsFailed = args.PixelsFailed;
+      if (args.ImgA) {
+         pair.ImgA = args.ImgA->Get_Name();
+         pair.ImgB = args.ImgB->Get_Name();
+      }
+   }
+
+   pair.Milliseconds = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+int Run_Batch(const char *manifest, int argc, char **argv)
+{
+   std::ifstream in(manifest);
+   if (!in) {
+      fprintf(stderr, "Cannot open %s\n", manifest);
+      return -1;
+   }
+
+   // Options shared by all pairs; -threads sizes the pool of pairs
+   int num_threads = 0;
+   std::vector<std::string> common;
+   common.push_back(argv[0]);
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-batch") == 0) {
+         i++;
+      } else if (strcmp(argv[i], "-threads") == 0) {
+         if (++i < argc) num_threads = atoi(argv[i]);
+      } else {
+         common.push_back(argv[i]);
+      }
+   }
+
+   std::vector<BatchPair> pairs;
+   std::string line;
+   for (int n = 1; std::getline(in, line); n++) {
+      std::istringstream words(line);
+      BatchPair pair;
+      std::string word;
+      while (words >> word) pair.Tokens.push_back(word);
+      if (pair.Tokens.empty() || pair.Tokens[0][0] == '#') continue;
+      pair.Line = n;
+      pair.PixelsFailed = 0;
+      pair.Milliseconds = 0;
+      pair.Done = false;
+      pairs.push_back(pair);
+   }
+
+   // Each thread takes the next pair when it finishes one, and whoever
+   // completes the first pair not yet printed prints everything done since
+   const int count = (int) pairs.size();
+   std::atomic<int> next(0);
+   std::mutex print_mutex;
+   int printed = 0, mismatches = 0;
+   ThreadPool pool(num_threads);
+   pool.Parallel_For(0, pool.Get_Num_Threads(), [&](int, int) {
+      int i;
+      while ((i = next++) < count) {
+         Compare_Pair(common, pairs[i]);
+         std::lock_guard<std::mutex> lock(print_mutex);
+         pairs[i].Done = true;
+         for (; printed < count && pairs[printed].Done; printed++) {
+            const BatchPair &p = pairs[printed];
+            if (p.Result != p.Tokens[0]) mismatches++;
+            char pixels[16] = "-";
+            if (p.Result != "ERROR") sprintf(pixels, "%u", p.PixelsFailed);
+            printf("%s\t%s\t%s\t%.1f\t%s\t%s\n", p.Result.c_str(), p.Tokens[0].c_str(),
+               pixels, p.Milliseconds, p.ImgA.c_str(), p.ImgB.c_str());
+         }
+         fflush(stdout);
+      }
+   });
+
+   if (mismatches) {
+      fprintf(stderr, "*** %d of %d pairs did not give the expected result\n", mismatches, count);
+   }
+   return mismatches ? 1 : 0;
+}
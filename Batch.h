@@ -0,0 +1,35 @@
+/*
+Batch
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+// Compares every pair listed in the manifest, one per line in the format
+// of test/run_tests.sh:
+//
+//    (PASS|FAIL) image1 image2 [options]
+//
+// Blank lines and lines starting with # are skipped. The other arguments
+// on the command line apply to every pair, before the pair's own options.
+// Pairs run concurrently, one per thread, and for each one a tab separated
+//
+//    result expected pixels_failed milliseconds image1 image2
+//
+// line is printed in manifest order, result being PASS, FAIL or ERROR.
+// Returns 0 if every result matched the expected one, 1 otherwise.
+int Run_Batch(const char *manifest, int argc, char **argv);
+
+#endif
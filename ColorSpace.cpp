@@ -0,0 +1,375 @@
+/*
+ColorSpace
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "ColorSpace.h"
+#include "RGBAImage.h"
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Reference white, AdobeRGBToXYZ(1, 1, 1) evaluated at compile time
+static const float WhiteX = 0.576700f + 0.185556f + 0.188212f;
+static const float WhiteY = 0.297361f + 0.627355f + 0.0752847f;
+static const float WhiteZ = 0.0270328f + 0.0706879f + 0.991248f;
+
+static const float LabEpsilon = 216.0f / 24389.0f;
+static const float LabKappa = 24389.0f / 27.0f;
+
+void AdobeRGBToXYZ(float r, float g, float b, float &x, float &y, float &z)
+{
+   // matrix is from http://www.brucelindbloom.com/
+   x = r * 0.576700f + g * 0.185556f + b * 0.188212f;
+   y = r * 0.297361f + g * 0.627355f + b * 0.0752847f;
+   z = r * 0.0270328f + g * 0.0706879f + b * 0.991248f;
+}
+
+void XYZToLAB(float x, float y, float z, float &L, float &A, float &B)
+{
+   float f[3];
+   float r[3];
+   r[0] = x / WhiteX;
+   r[1] = y / WhiteY;
+   r[2] = z / WhiteZ;
+   for (int i = 0; i < 3; i++) {
+      if (r[i] > LabEpsilon) {
+         f[i] = powf(r[i], 1.0f / 3.0f);
+      } else {
+         f[i] = (LabKappa * r[i] + 16.0f) / 116.0f;
+      }
+   }
+   L = 116.0f * f[1] - 16.0f;
+   A = 500.0f * (f[0] - f[1]);
+   B = 200.0f * (f[1] - f[2]);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Approximations. The scalar and the SSE versions perform the same
+// operations in the same order, so both give identical results.
+//////////////////////////////////////////////////////////////////////
+
+// log2(m) = C1 * atanh(t) with t = (m - 1) / (m + 1), m in [sqrt(1/2), sqrt(2))
+static const float LogC1 = 2.88539008f;
+static const float LogC3 = 0.961796694f;
+static const float LogC5 = 0.577078016f;
+static const float LogC7 = 0.412198583f;
+static const float LogC9 = 0.320598898f;
+
+// 2^f = exp(f ln 2) for f in [-0.5, 0.5]
+static const float ExpP1 = 0.693147181f;
+static const float ExpP2 = 0.240226507f;
+static const float ExpP3 = 0.0555041087f;
+static const float ExpP4 = 0.00961812911f;
+static const float ExpP5 = 0.00133335581f;
+static const float ExpP6 = 0.000154035304f;
+static const float ExpP7 = 1.52527338e-05f;
+
+// Adding and subtracting 1.5 * 2^23 rounds to the nearest integer
+static const float RoundMagic = 12582912.0f;
+
+static inline float As_Float(int i) { float f; memcpy(&f, &i, 4); return f; }
+static inline int As_Int(float f) { int i; memcpy(&i, &f, 4); return i; }
+
+static inline float Fast_Log2(float x)
+{
+   int bits = As_Int(x);
+   int e = ((bits >> 23) & 0xff) - 127;
+   float m = As_Float((bits & 0x007fffff) | 0x3f800000);
+   if (m > 1.41421356f) {
+      m *= 0.5f;
+      e += 1;
+   }
+   float t = (m - 1.0f) / (m + 1.0f);
+   float t2 = t * t;
+   float p = LogC1 + t2 * (LogC3 + t2 * (LogC5 + t2 * (LogC7 + t2 * LogC9)));
+   return (float) e + t * p;
+}
+
+static inline float Fast_Exp2(float y)
+{
+   if (y < -126.0f) y = -126.0f;
+   if (y > 128.0f) y = 128.0f;
+   float n = (y + RoundMagic) - RoundMagic;
+   float f = y - n;
+   float p = ExpP1 + f * (ExpP2 + f * (ExpP3 + f * (ExpP4 + f * (ExpP5 + f * (ExpP6 + f * ExpP7)))));
+   p = 1.0f + f * p;
+   return p * As_Float(((int) n + 127) << 23);
+}
+
+// powf(x, gamma) for gamma > 0
+static inline float Fast_Pow(float x, float gamma)
+{
+   if (x >= FLT_MIN && x <= FLT_MAX) return Fast_Exp2(gamma * Fast_Log2(x));
+   if (x >= 0.0f && x < FLT_MIN) return 0.0f;
+   return powf(x, gamma);
+}
+
+// Cube root of a positive normal number: a bit level estimate refined by
+// two Halley iterations, each of which triples the number of correct digits
+static inline float Fast_Cbrt(float r)
+{
+   float y = As_Float((int) ((float) As_Int(r) * (1.0f / 3.0f)) + 709921077);
+   float y3 = y * y * y;
+   y = y * (y3 + 2.0f * r) / (2.0f * y3 + r);
+   y3 = y * y * y;
+   y = y * (y3 + 2.0f * r) / (2.0f * y3 + r);
+   return y;
+}
+
+static inline float Lab_F(float r)
+{
+   return (r > LabEpsilon) ? Fast_Cbrt(r) : (LabKappa * r + 16.0f) / 116.0f;
+}
+
+static inline void Convert_Pixel_Fast(const RGBAFloat &p, float gamma, float luminance,
+   float *lum, float *A, float *B)
+{
+   float r = Fast_Pow(p.mR, gamma);
+   float g = Fast_Pow(p.mG, gamma);
+   float b = Fast_Pow(p.mB, gamma);
+   float x, y, z;
+   AdobeRGBToXYZ(r, g, b, x, y, z);
+   if (lum) *lum = y * luminance;
+   if (A) {
+      float fx = Lab_F(x * (1.0f / WhiteX));
+      float fy = Lab_F(y * (1.0f / WhiteY));
+      float fz = Lab_F(z * (1.0f / WhiteZ));
+      *A = 500.0f * (fx - fy);
+      *B = 200.0f * (fy - fz);
+   }
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+   return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 Fast_Log2_SSE(__m128 x)
+{
+   __m128i bits = _mm_castps_si128(x);
+   __m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)),
+      _mm_set1_epi32(127));
+   __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+      _mm_set1_epi32(0x3f800000)));
+   __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+   m = Select(big, _mm_mul_ps(m, _mm_set1_ps(0.5f)), m);
+   e = _mm_sub_epi32(e, _mm_castps_si128(big));
+   __m128 one = _mm_set1_ps(1.0f);
+   __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+   __m128 t2 = _mm_mul_ps(t, t);
+   __m128 p = _mm_add_ps(_mm_set1_ps(LogC7), _mm_mul_ps(t2, _mm_set1_ps(LogC9)));
+   p = _mm_add_ps(_mm_set1_ps(LogC5), _mm_mul_ps(t2, p));
+   p = _mm_add_ps(_mm_set1_ps(LogC3), _mm_mul_ps(t2, p));
+   p = _mm_add_ps(_mm_set1_ps(LogC1), _mm_mul_ps(t2, p));
+   return _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(t, p));
+}
+
+static inline __m128 Fast_Exp2_SSE(__m128 y)
+{
+   y = _mm_max_ps(y, _mm_set1_ps(-126.0f));
+   y = _mm_min_ps(y, _mm_set1_ps(128.0f));
+   __m128 magic = _mm_set1_ps(RoundMagic);
+   __m128 n = _mm_sub_ps(_mm_add_ps(y, magic), magic);
+   __m128 f = _mm_sub_ps(y, n);
+   __m128 p = _mm_add_ps(_mm_set1_ps(ExpP6), _mm_mul_ps(f, _mm_set1_ps(ExpP7)));
+   p = _mm_add_ps(_mm_set1_ps(ExpP5), _mm_mul_ps(f, p));
+   p = _mm_add_ps(_mm_set1_ps(ExpP4), _mm_mul_ps(f, p));
+   p = _mm_add_ps(_mm_set1_ps(ExpP3), _mm_mul_ps(f, p));
+   p = _mm_add_ps(_mm_set1_ps(ExpP2), _mm_mul_ps(f, p));
+   p = _mm_add_ps(_mm_set1_ps(ExpP1), _mm_mul_ps(f, p));
+   p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+   __m128i scale = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+   return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+// Fast_Pow for lanes that are zero or positive, finite numbers
+static inline __m128 Fast_Pow_SSE(__m128 x, __m128 gamma)
+{
+   __m128 p = Fast_Exp2_SSE(_mm_mul_ps(gamma, Fast_Log2_SSE(x)));
+   return _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(FLT_MIN)), p);
+}
+
+static inline __m128 Fast_Cbrt_SSE(__m128 r)
+{
+   __m128 third = _mm_set1_ps(1.0f / 3.0f);
+   __m128i guess = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(r)), third));
+   __m128 y = _mm_castsi128_ps(_mm_add_epi32(guess, _mm_set1_epi32(709921077)));
+   __m128 two = _mm_set1_ps(2.0f);
+   for (int i = 0; i < 2; i++) {
+      __m128 y3 = _mm_mul_ps(_mm_mul_ps(y, y), y);
+      y = _mm_div_ps(_mm_mul_ps(y, _mm_add_ps(y3, _mm_mul_ps(two, r))),
+         _mm_add_ps(_mm_mul_ps(two, y3), r));
+   }
+   return y;
+}
+
+static inline __m128 Lab_F_SSE(__m128 r)
+{
+   __m128 linear = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(LabKappa), r), _mm_set1_ps(16.0f)),
+      _mm_set1_ps(116.0f));
+   return Select(_mm_cmpgt_ps(r, _mm_set1_ps(LabEpsilon)), Fast_Cbrt_SSE(r), linear);
+}
+
+// Converts 4 pixels, returns false if any channel needs the scalar path
+static inline bool Convert_Quad_SSE(const RGBAFloat *src, __m128 gamma, float luminance,
+   float *lum, float *A, float *B)
+{
+   __m128 r = _mm_loadu_ps(&src[0].mR);
+   __m128 g = _mm_loadu_ps(&src[1].mR);
+   __m128 b = _mm_loadu_ps(&src[2].mR);
+   __m128 a = _mm_loadu_ps(&src[3].mR);
+   _MM_TRANSPOSE4_PS(r, g, b, a);
+
+   // zero or positive finite values only; NaN fails both comparisons
+   __m128 zero = _mm_setzero_ps();
+   __m128 max = _mm_set1_ps(FLT_MAX);
+   __m128 ok = _mm_and_ps(_mm_cmpge_ps(r, zero), _mm_cmple_ps(r, max));
+   ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(g, zero), _mm_cmple_ps(g, max)));
+   ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(b, zero), _mm_cmple_ps(b, max)));
+   if (_mm_movemask_ps(ok) != 0xf) return false;
+
+   r = Fast_Pow_SSE(r, gamma);
+   g = Fast_Pow_SSE(g, gamma);
+   b = Fast_Pow_SSE(b, gamma);
+
+   __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.576700f)),
+      _mm_mul_ps(g, _mm_set1_ps(0.185556f))), _mm_mul_ps(b, _mm_set1_ps(0.188212f)));
+   __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.297361f)),
+      _mm_mul_ps(g, _mm_set1_ps(0.627355f))), _mm_mul_ps(b, _mm_set1_ps(0.0752847f)));
+   __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.0270328f)),
+      _mm_mul_ps(g, _mm_set1_ps(0.0706879f))), _mm_mul_ps(b, _mm_set1_ps(0.991248f)));
+   if (lum) _mm_storeu_ps(lum, _mm_mul_ps(y, _mm_set1_ps(luminance)));
+   if (A) {
+      __m128 fx = Lab_F_SSE(_mm_mul_ps(x, _mm_set1_ps(1.0f / WhiteX)));
+      __m128 fy = Lab_F_SSE(_mm_mul_ps(y, _mm_set1_ps(1.0f / WhiteY)));
+      __m128 fz = Lab_F_SSE(_mm_mul_ps(z, _mm_set1_ps(1.0f / WhiteZ)));
+      _mm_storeu_ps(A, _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy)));
+      _mm_storeu_ps(B, _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz)));
+   }
+   return true;
+}
+
+#endif
+
+void Convert_Span(const RGBAFloat *src, int n, float gamma, float luminance,
+   bool exact, float *lum, float *A, float *B)
+{
+   if (exact || !(gamma > 0.0f)) {
+      for (int i = 0; i < n; i++) {
+         // TODO: It might make sense to use values which are clamped to a displayable range
+         // (0.0-1.0) is some scenarios, but for now we ignore the fact that pixels above 1.0
+         // do not perceptually differ from those with value 1.0 and do the copmutations
+         // as if they were distinguishable.
+         float r = powf(src[i].mR, gamma);
+         float g = powf(src[i].mG, gamma);
+         float b = powf(src[i].mB, gamma);
+         float x, y, z, l, a, bb;
+         AdobeRGBToXYZ(r, g, b, x, y, z);
+         if (A) {
+            XYZToLAB(x, y, z, l, a, bb);
+            A[i] = a;
+            B[i] = bb;
+         }
+         if (lum) lum[i] = y * luminance;
+      }
+      return;
+   }
+
+   int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+   const __m128 g4 = _mm_set1_ps(gamma);
+   for (; i + 4 <= n; i += 4) {
+      if (Convert_Quad_SSE(src + i, g4, luminance, lum ? lum + i : 0,
+            A ? A + i : 0, B ? B + i : 0)) {
+         continue;
+      }
+      for (int j = i; j < i + 4; j++) {
+         Convert_Pixel_Fast(src[j], gamma, luminance, lum ? lum + j : 0,
+            A ? A + j : 0, B ? B + j : 0);
+      }
+   }
+#endif
+   for (; i < n; i++) {
+      Convert_Pixel_Fast(src[i], gamma, luminance, lum ? lum + i : 0,
+         A ? A + i : 0, B ? B + i : 0);
+   }
+}
+
+GammaTable::GammaTable(float gamma)
+{
+   for (int i = 0; i < 256; i++) {
+      float v = powf(ConvertRGBAInt32CompToFloat(static_cast<RGBAInt32Comp>(i)), gamma);
+      AdobeRGBToXYZ(v, 0.0f, 0.0f, X[0][i], Y[0][i], Z[0][i]);
+      AdobeRGBToXYZ(0.0f, v, 0.0f, X[1][i], Y[1][i], Z[1][i]);
+      AdobeRGBToXYZ(0.0f, 0.0f, v, X[2][i], Y[2][i], Z[2][i]);
+   }
+}
+
+void Convert_Span_8Bit(const unsigned char *src, int n, int channels, const int offset[3],
+   const GammaTable &table, float luminance, bool exact, float *lum, float *A, float *B)
+{
+   const unsigned char *red = src + offset[0];
+   const unsigned char *green = src + offset[1];
+   const unsigned char *blue = src + offset[2];
+   int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+   if (A && !exact) {
+      for (; i + 4 <= n; i += 4) {
+         float x[4], y[4], z[4];
+         for (int j = 0; j < 4; j++) {
+            const int r = red[(i + j) * channels];
+            const int g = green[(i + j) * channels];
+            const int b = blue[(i + j) * channels];
+            x[j] = table.X[0][r] + table.X[1][g] + table.X[2][b];
+            y[j] = table.Y[0][r] + table.Y[1][g] + table.Y[2][b];
+            z[j] = table.Z[0][r] + table.Z[1][g] + table.Z[2][b];
+         }
+         __m128 y4 = _mm_loadu_ps(y);
+         if (lum) _mm_storeu_ps(lum + i, _mm_mul_ps(y4, _mm_set1_ps(luminance)));
+         __m128 fx = Lab_F_SSE(_mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(1.0f / WhiteX)));
+         __m128 fy = Lab_F_SSE(_mm_mul_ps(y4, _mm_set1_ps(1.0f / WhiteY)));
+         __m128 fz = Lab_F_SSE(_mm_mul_ps(_mm_loadu_ps(z), _mm_set1_ps(1.0f / WhiteZ)));
+         _mm_storeu_ps(A + i, _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy)));
+         _mm_storeu_ps(B + i, _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz)));
+      }
+   }
+#endif
+   for (; i < n; i++) {
+      const int r = red[i * channels];
+      const int g = green[i * channels];
+      const int b = blue[i * channels];
+      float y = table.Y[0][r] + table.Y[1][g] + table.Y[2][b];
+      if (lum) lum[i] = y * luminance;
+      if (!A) continue;
+      float x = table.X[0][r] + table.X[1][g] + table.X[2][b];
+      float z = table.Z[0][r] + table.Z[1][g] + table.Z[2][b];
+      if (exact) {
+         float l;
+         XYZToLAB(x, y, z, l, A[i], B[i]);
+      } else {
+         float fx = Lab_F(x * (1.0f / WhiteX));
+         float fy = Lab_F(y * (1.0f / WhiteY));
+         float fz = Lab_F(z * (1.0f / WhiteZ));
+         A[i] = 500.0f * (fx - fy);
+         B[i] = 200.0f * (fy - fz);
+      }
+   }
+}
@@ -0,0 +1,57 @@
+/*
+ColorSpace
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _COLORSPACE_H
+#define _COLORSPACE_H
+
+class RGBAFloat;
+
+// convert Adobe RGB (1998) with reference white D65 to XYZ
+void AdobeRGBToXYZ(float r, float g, float b, float &x, float &y, float &z);
+
+// convert XYZ to CIE L*a*b* relative to the Adobe RGB (1998) white point
+void XYZToLAB(float x, float y, float z, float &L, float &A, float &B);
+
+// Converts n pixels from gamma encoded Adobe RGB (1998) to luminance
+// (Y * luminance, in candela per meter squared) and the LAB chroma channels.
+// Any of lum, A and B may be NULL if that output is not needed.
+//
+// With exact set this calls powf exactly like the per-pixel functions above.
+// Otherwise pow and cbrt use polynomial approximations evaluated four pixels
+// at a time; over inputs in [1e-6, 1e4] and gammas from 1 to 3 their maximum
+// relative error is 3.5e-6 for the gamma curve and 2.5e-7 for the cube root.
+void Convert_Span(const RGBAFloat *src, int n, float gamma, float luminance,
+   bool exact, float *lum, float *A, float *B);
+
+// XYZ contribution of every 8-bit value of each channel for one gamma. The
+// entries are powf(i / 255.0f, gamma) times the matrix coefficient, so sums
+// of them are bit for bit what AdobeRGBToXYZ returns on the exact path.
+struct GammaTable
+{
+   GammaTable(float gamma);
+
+   float X[3][256];
+   float Y[3][256];
+   float Z[3][256];
+};
+
+// Same as Convert_Span for n pixels of 8-bit components, each pixel being
+// `channels` bytes with red, green and blue at offset[0..2], with pow
+// replaced by lookups in table.
+void Convert_Span_8Bit(const unsigned char *src, int n, int channels, const int offset[3],
+   const GammaTable &table, float luminance, bool exact, float *lum, float *A, float *B);
+
+#endif
@@ -16,9 +16,16 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 
 #include "CompareArgs.h"
 #include "RGBAImage.h"
+#include "ResultCache.h"
+#include "Stats.h"
+#include "AlignedBuffer.h"
+#include "Metric.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 static const char* copyright =
 "PerceptualDiff version 1.2.0, Copyright (C) 2006 Yangli Hector Yee\n\
@@ -39,7 +46,24 @@ static const char *usage =
 \t-luminanceonly : Only consider luminance; ignore chroma (color) in the comparison\n\
 \t-colorfactor   : How much of color to use, 0.0 to 1.0, 0.0 = ignore color.\n\
 \t-downsample    : How many powers of two to down sample the image.\n\
+\t-threads n     : Number of threads to use (default: one per core)\n\
+\t-decimated     : Use a decimated pyramid (different pixel counts)\n\
+\t-exactmath     : Use libm's powf for colour conversion instead of approximations\n\
+\t-halfprecision : Store the pyramids and chroma as 16 bit floats (less memory)\n\
+\t-cache dir     : Reuse the results of earlier comparisons stored in dir\n\
+\t-failfast      : Stop once the threshold is reached (ignored with -output)\n\
+\t-refcache f    : Cache image1's pyramid and chroma in the file f\n\
+\t-stats f.json  : Write the time and memory of every stage to f.json (- for stdout)\n\
+\t-roi x,y,w,h   : Only test the pixels of this rectangle; may be repeated\n\
+\t-mask m.png    : Ignore the pixels that are not black in m.png\n\
 \t-output o.ppm  : Write difference to the file o.ppm\n\
+\t-failmask f.pbm : Write the failed pixels as a 1 bit PBM mask to f.pbm\n\
+\t-failspans f   : Write the runs of failed pixels, one \"y x0 x1\" per line\n\
+\t-failboxes f   : Write the failed regions, one \"x0 y0 x1 y1 pixels\" per line\n\
+\t-batch m.txt   : Compare every pair listed in m.txt, see the README\n\
+\t-sequence a b  : Compare frames a to b, %04d etc. in names being the frame\n\
+\t-serve sock    : Serve comparisons on the Unix domain socket sock\n\
+\t-client sock   : Have the server at sock run this comparison\n\
 \n\
 \n Note: Input or Output files can also be in the PNG or JPG format or any format\
 \n that FreeImage supports.\
@@ -58,6 +82,26 @@ CompareArgs::CompareArgs()
    Luminance = 100.0f;
    ColorFactor = 1.0f;
    DownSample = 0;
+   NumThreads = 0;
+   DecimatedPyramid = false;
+   ExactMath = false;
+   HalfPrecision = false;
+   FailFast = false;
+   RefSlot = NULL;
+   Stats = NULL;
+   Workspace = NULL;
+   CacheHit = false;
+   CachedPass = false;
+   Mask = NULL;
+   MaskStride = 0;
+   FailBits = NULL;
+   FailBitsStride = 0;
+   Selected = NULL;
+   SelectedStride = 0;
+   PixelsFailed = 0;
+   Identical = false;
+   Stopped = false;
+   WorkspacePeakBytes = 0;
 }
 
 CompareArgs::~CompareArgs()
@@ -65,6 +109,7 @@ CompareArgs::~CompareArgs()
    if (ImgA) delete ImgA;
    if (ImgB) delete ImgB;
    if (ImgDiff) delete ImgDiff;
+   delete Stats;
 }
 
 bool CompareArgs::Parse_Args(int argc, char **argv)
@@ -75,7 +120,6 @@ bool CompareArgs::Parse_Args(int argc, char **argv)
       return false;
    }
    int image_count = 0;
-   const char* output_file_name = NULL;
    for (int i = 1; i < argc; i++) {
       if (strcmp(argv[i], "-fov") == 0) {
          if (++i < argc) {
@@ -105,48 +149,215 @@ bool CompareArgs::Parse_Args(int argc, char **argv)
          if (++i < argc) {
             DownSample = (int) atoi(argv[i]);
          }
+      } else if (strcmp(argv[i], "-threads") == 0) {
+         if (++i < argc) {
+            NumThreads = atoi(argv[i]);
+         }
+      } else if (strcmp(argv[i], "-decimated") == 0) {
+         DecimatedPyramid = true;
+      } else if (strcmp(argv[i], "-exactmath") == 0) {
+         ExactMath = true;
+      } else if (strcmp(argv[i], "-halfprecision") == 0) {
+         HalfPrecision = true;
+      } else if (strcmp(argv[i], "-cache") == 0) {
+         if (++i < argc) {
+            CacheDir = argv[i];
+         }
+      } else if (strcmp(argv[i], "-failfast") == 0) {
+         FailFast = true;
+      } else if (strcmp(argv[i], "-refcache") == 0) {
+         if (++i < argc) {
+            RefCacheFile = argv[i];
+         }
+      } else if (strcmp(argv[i], "-stats") == 0) {
+         if (++i < argc) {
+            StatsFile = argv[i];
+         }
+      } else if (strcmp(argv[i], "-failmask") == 0) {
+         if (++i < argc) {
+            FailMaskFile = argv[i];
+         }
+      } else if (strcmp(argv[i], "-failspans") == 0) {
+         if (++i < argc) {
+            FailSpansFile = argv[i];
+         }
+      } else if (strcmp(argv[i], "-failboxes") == 0) {
+         if (++i < argc) {
+            FailBoxesFile = argv[i];
+         }
+      } else if (strcmp(argv[i], "-roi") == 0) {
+         if (++i < argc) {
+            int r[4];
+            char end;
+            if (sscanf(argv[i], "%d,%d,%d,%d%c", &r[0], &r[1], &r[2], &r[3], &end) != 4 ||
+                  r[2] < 0 || r[3] < 0) {
+               ErrorStr = "FAIL: -roi takes x,y,width,height\n";
+               return false;
+            }
+            Regions.insert(Regions.end(), r, r + 4);
+         }
+      } else if (strcmp(argv[i], "-mask") == 0) {
+         if (++i < argc) {
+            IgnoreMaskFile = argv[i];
+         }
       } else if (strcmp(argv[i], "-output") == 0) {
          if (++i < argc) {
-            output_file_name = argv[i];
+            OutputFile = argv[i];
          }
       } else if (image_count < 2) {
-         RGBAFloatImage* img = RGBAFloatImage::ReadFromFile(argv[i]);
-         if (!img) {
-            ErrorStr = "FAIL: Cannot open ";
-            ErrorStr += argv[i];
-            ErrorStr += "\n";
-            return false;
-         } else {
-            ++image_count;
-            if(image_count == 1)
-               ImgA = img;
-            else
-               ImgB = img;
-         }
+         ImageFiles[image_count++] = argv[i];
       } else {
-         fprintf(stderr, "Warning: option/file \"%s\" ignored\n", argv[i]);
+         Warnings += "Warning: option/file \"" + std::string(argv[i]) + "\" ignored\n";
       }
    } // i
-   if(!ImgA || !ImgB) {
+   if (image_count < 2) {
       ErrorStr = "FAIL: Not enough image files specified\n";
       return false;
    }
+   // Those pyramids are kept in float; dropping the option here keeps it
+   // out of the result cache keys as well
+   if (HalfPrecision && (DecimatedPyramid || !RefCacheFile.empty())) {
+      Warnings += std::string("Warning: -halfprecision ignored with ") +
+         (DecimatedPyramid ? "-decimated" : "-refcache") + "\n";
+      HalfPrecision = false;
+   }
+   if (!StatsFile.empty()) Stats = new CompareStats;
+   return true;
+}
+
+// Decodes image i, the reference when 0, and down samples it; NULL if it
+// cannot be read, with the reason in error
+RGBAFloatImage *CompareArgs::Load_Image(int i, std::string &error)
+{
+   RGBAFloatImage *img;
+   {
+      StageTimer timer(Stats, STATS_DECODE);
+      img = i == 0 && LoadReference ? LoadReference(ImageFiles[i].c_str()) :
+         RGBAFloatImage::ReadFromFile(ImageFiles[i].c_str(), &error);
+      if (!img) {
+         if (error.empty()) error = "Cannot open " + ImageFiles[i];
+         return NULL;
+      }
+      timer.Add_Pixels((uint64_t) img->Get_Width() * img->Get_Height());
+      timer.Add_Bytes((uint64_t) img->Get_Height() * std::abs(img->Get_Row_Stride()));
+   }
+   if (DownSample > 0) {
+      StageTimer timer(Stats, STATS_DOWNSAMPLE, (uint64_t) img->Get_Width() * img->Get_Height());
+      RGBAFloatImage *tmp = img->DownSample(DownSample);
+      if (tmp) {
+         timer.Add_Bytes((uint64_t) tmp->Get_Width() * tmp->Get_Height() * sizeof(RGBAFloat));
+         delete img;
+         img = tmp;
+      }
+   }
+   return img;
+}
+
+bool CompareArgs::Load_Images()
+{
+   // A verdict cached for the same bytes and options needs no decoding;
+   // the difference image and the reports always do
+   const bool reports = !FailMaskFile.empty() || !FailSpansFile.empty() ||
+      !FailBoxesFile.empty();
+   const bool selection = !Regions.empty() || !IgnoreMaskFile.empty();
+   if (!CacheDir.empty() && OutputFile.empty() && !reports && !selection) {
+      FileKey = ResultCache::File_Key(ImageFiles[0].c_str(), ImageFiles[1].c_str(), *this);
+      bool passed;
+      if (!FileKey.empty() &&
+         ResultCache(CacheDir).Lookup(FileKey, passed, PixelsFailed, ErrorStr)) {
+         CacheHit = true;
+         CachedPass = passed;
+         return true;
+      }
+   }
+
    for (int i = 0; i < DownSample; i++) {
       if (Verbose) printf("Downsampling by %d\n", 1 << (i+1));
-      RGBAFloatImage *tmp = ImgA->DownSample();
-      if (tmp) {
-         delete ImgA;
-         ImgA = tmp;
+   }
+
+   // The two images are decoded and down sampled at the same time, each on
+   // its own thread when there are two, those the comparison runs on
+   ThreadPool &pool = (Workspace ? *Workspace : Thread_Workspace(NumThreads)).Pool;
+   RGBAFloatImage *imgs[2] = { NULL, NULL };
+   std::string errors[2];
+   pool.Parallel_For(0, 2, [&](int i0, int i1) {
+      for (int i = i0; i < i1; i++) imgs[i] = Load_Image(i, errors[i]);
+   });
+   ImgA = imgs[0];
+   ImgB = imgs[1];
+   for (int i = 0; i < 2; i++) {
+      if (!imgs[i]) {
+         ErrorStr = "FAIL: " + errors[i] + "\n";
+         return false;
       }
-      tmp = ImgB->DownSample();
-      if (tmp) {
-         delete ImgB;
-         ImgB = tmp;
+   }
+   if (!OutputFile.empty()) {
+      ImgDiff = new RGBAFloatImage(ImgA->Get_Width(), ImgA->Get_Height(), OutputFile.c_str());
+   }
+   if (reports) {
+      FailBitsStride = (ImgA->Get_Width() + 7) / 8;
+      const size_t bytes = FailBitsStride * (size_t) ImgA->Get_Height();
+      FailBitsMemory = Aligned_Shared<unsigned char>(bytes);
+      FailBits = FailBitsMemory.get();
+      memset(FailBits, 0, bytes);
+   }
+   return !selection || Select_Pixels();
+}
+
+// Makes Selected: the pixels inside a region, or all of them without
+// regions, less those where the ignore mask is not black. Both are given
+// for the input images and scaled down with them.
+bool CompareArgs::Select_Pixels()
+{
+   const int w = ImgA->Get_Width();
+   const int h = ImgA->Get_Height();
+   SelectedStride = (w + 7) / 8;
+   const size_t bytes = SelectedStride * (size_t) h;
+   SelectedMemory = Aligned_Shared<unsigned char>(bytes);
+   unsigned char *selected = SelectedMemory.get();
+   Selected = selected;
+   memset(selected, Regions.empty() ? 0xff : 0, bytes);
+   if (Regions.empty() && w % 8) {
+      // No bits past the end of a row, as in FailBits
+      for (int y = 0; y < h; y++) selected[w / 8 + y * SelectedStride] = 0xff00 >> (w % 8);
+   }
+   const int scale = 1 << DownSample;
+   for (size_t r = 0; r < Regions.size(); r += 4) {
+      const int x0 = std::max(Regions[r] / scale, 0);
+      const int y0 = std::max(Regions[r + 1] / scale, 0);
+      const int x1 = std::min((Regions[r] + Regions[r + 2] + scale - 1) / scale, w);
+      const int y1 = std::min((Regions[r + 1] + Regions[r + 3] + scale - 1) / scale, h);
+      for (int y = y0; y < y1; y++) {
+         for (int x = x0; x < x1; x++) selected[(x >> 3) + y * SelectedStride] |= 0x80 >> (x & 7);
       }
    }
-   if(output_file_name) {
-      ImgDiff = new RGBAFloatImage(ImgA->Get_Width(), ImgA->Get_Height(), output_file_name);
+   if (IgnoreMaskFile.empty()) return true;
+
+   std::string error;
+   RGBAFloatImage *mask = RGBAFloatImage::ReadFromFile(IgnoreMaskFile.c_str(), &error);
+   if (mask && DownSample > 0) {
+      // A reduced pixel is ignored if any of its input pixels is
+      RGBAFloatImage *tmp = mask->DownSample(DownSample);
+      delete mask;
+      mask = tmp;
    }
+   if (!mask || mask->Get_Width() != w || mask->Get_Height() != h) {
+      ErrorStr = mask ? "FAIL: Mask dimensions do not match the images: " + IgnoreMaskFile :
+         "FAIL: " + error;
+      ErrorStr += "\n";
+      delete mask;
+      return false;
+   }
+   std::vector<RGBAFloat> row(w);
+   for (int y = 0; y < h; y++) {
+      mask->Get_Span(0, y, w, &row[0]);
+      for (int x = 0; x < w; x++) {
+         if (row[x].mR > 0 || row[x].mG > 0 || row[x].mB > 0) {
+            selected[(x >> 3) + y * SelectedStride] &= ~(0x80 >> (x & 7));
+         }
+      }
+   }
+   delete mask;
    return true;
 }
 
@@ -156,8 +367,16 @@ void CompareArgs::Print_Args()
    printf("Threshold pixels is %d pixels\n", ThresholdPixels);
    printf("The Gamma is %f\n", Gamma);
    printf("The Display's luminance is %f candela per meter squared\n", Luminance);
-   printf("Image 1 is    \"%s\"\n", ImgA->Get_Name().c_str());
-   printf("Image 2 is    \"%s\"\n", ImgB->Get_Name().c_str());
+   if (NumThreads > 0)
+      printf("Using %d threads\n", NumThreads);
+   else
+      printf("Using one thread per core\n");
+   if (CacheHit) {
+      printf("Result found in cache %s\n", CacheDir.c_str());
+   } else {
+      printf("Image 1 is    \"%s\"\n", ImgA->Get_Name().c_str());
+      printf("Image 2 is    \"%s\"\n", ImgB->Get_Name().c_str());
+   }
    if (ImgDiff != NULL)
       printf("Diff image is \"%s\"\n", ImgDiff->Get_Name().c_str());
 }
@@ -17,9 +17,16 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 #ifndef _COMPAREARGS_H
 #define _COMPAREARGS_H
 
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 class RGBAFloatImage;
+class RefCacheSlot;
+class CompareStats;
+class CompareWorkspace;
 
 // Args to pass into the comparison function
 class CompareArgs
@@ -27,9 +34,23 @@ class CompareArgs
 public:
    CompareArgs();
    ~CompareArgs();
+   // Sets the options and file names from the command line
    bool Parse_Args(int argc, char **argv);
+   // Loads the images named by Parse_Args, or the cached verdict
+   bool Load_Images();
    void Print_Args();
 
+   // Image files and difference image file named on the command line
+   std::string ImageFiles[2];
+   std::string OutputFile;
+   // Files of the compact reports of the failed pixels, see FailReport.h
+   std::string FailMaskFile, FailSpansFile, FailBoxesFile;
+   // Rectangles of -roi, x, y, width and height each in pixels of the
+   // input images, and the -mask image whose pixels that are not black
+   // are ignored
+   std::vector<int> Regions;
+   std::string IgnoreMaskFile;
+
    RGBAFloatImage    *ImgA;            // Image A
    RGBAFloatImage    *ImgB;            // Image B
    RGBAFloatImage    *ImgDiff;         // Diff image
@@ -40,12 +61,80 @@ public:
    float             Luminance;        // the display's luminance
    unsigned int      ThresholdPixels;  // How many pixels different to ignore
    std::string       ErrorStr;         // Error string
+   std::string       Warnings;         // Warnings of Parse_Args, one per line, for the caller to print
   // How much color to use in the metric.
   // 0.0 is the same as LuminanceOnly = true,
   // 1.0 means full strength.
   float ColorFactor;
   // How much to down sample image before comparing, in powers of 2.
   int DownSample;
+  // Number of threads to compare with, 0 means one per hardware core.
+  int NumThreads;
+  // Use a decimated (half resolution per level) Laplacian pyramid.
+  bool DecimatedPyramid;
+  // Use libm's powf for the colour conversion instead of the faster
+  // approximations.
+  bool ExactMath;
+  // Store the pyramid levels and chroma planes of the tiles as 16-bit
+  // floats. Not used with -decimated or a reference cache.
+  bool HalfPrecision;
+  // Stop testing once ThresholdPixels pixels failed, unless writing a diff image.
+  bool FailFast;
+  // Cache file of the first image's derived data, empty for none.
+  std::string RefCacheFile;
+  // Derived data of the first image kept in memory, used instead of
+  // RefCacheFile when set.
+  RefCacheSlot *RefSlot;
+  // Loads the first image in Load_Images instead of
+  // RGBAFloatImage::ReadFromFile when set.
+  std::function<RGBAFloatImage *(const char *)> LoadReference;
+  // Directory of the result cache, empty for none.
+  std::string CacheDir;
+  // Result cache key of the two input files, set by Load_Images.
+  std::string FileKey;
+  // Set by Load_Images when the verdict was found in the result cache; the
+  // images are then not loaded and Yee_Compare returns CachedPass.
+  bool CacheHit;
+  bool CachedPass;
+  // File the -stats JSON report goes to, "-" for stdout.
+  std::string StatsFile;
+  // Per stage measurements, NULL unless StatsFile is set.
+  CompareStats *Stats;
+  // Threads and buffers to load and compare with, kept by the caller
+  // between comparisons; NULL for those the calling thread keeps for itself.
+  CompareWorkspace *Workspace;
+  // Optional per pixel output of the test, 255 where a pixel failed and 0
+  // elsewhere; pixel (x, y) is Mask[x + y * MaskStride].
+  unsigned char *Mask;
+  ptrdiff_t MaskStride;
+  // Optional packed per pixel output, pixel (x, y) failed where bit
+  // 7 - x % 8 of FailBits[x / 8 + y * FailBitsStride] is set; cleared by the
+  // caller. Load_Images makes it when a compact report is asked for.
+  unsigned char *FailBits;
+  ptrdiff_t FailBitsStride;
+  // Optional packed selection of the pixels to test, laid out as FailBits;
+  // the others pass without being converted or tested. NULL tests all.
+  // Load_Images makes it from Regions and IgnoreMaskFile.
+  const unsigned char *Selected;
+  ptrdiff_t SelectedStride;
+  // Number of pixels that failed the test, set by Compare_Images; a lower
+  // bound when Stopped is set.
+  unsigned int PixelsFailed;
+  // Set by Compare_Images when the images have the same pixel values, so
+  // the metric did not need to run.
+  bool Identical;
+  // Set by Compare_Images when FailFast stopped testing early.
+  bool Stopped;
+  // Set by Compare_Images: the high-water mark of the buffers of the
+  // workspace it used, in bytes.
+  size_t WorkspacePeakBytes;
+
+private:
+   RGBAFloatImage *Load_Image(int i, std::string &error);
+   bool Select_Pixels();
+
+   std::shared_ptr<unsigned char> FailBitsMemory;
+   std::shared_ptr<unsigned char> SelectedMemory;
 };
 
 #endif
@@ -0,0 +1,151 @@
+/*
+FailReport
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "FailReport.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+struct FailSpan
+{
+   int X0, X1;
+};
+
+// Appends the runs of failed pixels of a row of bits to spans
+static void Row_Spans(const unsigned char *row, int w, std::vector<FailSpan> &spans)
+{
+   const int bytes = (w + 7) / 8;
+   int start = -1;
+   for (int b = 0; b < bytes; b++) {
+      // Whole bytes of passed or failed pixels are skipped
+      if (row[b] == (start < 0 ? 0x00 : 0xff)) continue;
+      for (int x = b * 8; x < b * 8 + 8 && x < w; x++) {
+         const bool failed = (row[b] & (0x80 >> (x & 7))) != 0;
+         if (failed && start < 0) {
+            start = x;
+         } else if (!failed && start >= 0) {
+            FailSpan s = { start, x };
+            spans.push_back(s);
+            start = -1;
+         }
+      }
+   }
+   if (start >= 0) {
+      FailSpan s = { start, w };
+      spans.push_back(s);
+   }
+}
+
+bool Write_Fail_Mask(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h)
+{
+   FILE *f = fopen(path, "wb");
+   if (!f) return false;
+   fprintf(f, "P4\n%d %d\n", w, h);
+   const size_t bytes = (w + 7) / 8;
+   bool ok = true;
+   for (int y = 0; y < h && ok; y++) ok = fwrite(bits + y * stride, 1, bytes, f) == bytes;
+   return fclose(f) == 0 && ok;
+}
+
+bool Write_Fail_Spans(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h)
+{
+   FILE *f = fopen(path, "w");
+   if (!f) return false;
+   std::vector<FailSpan> spans;
+   for (int y = 0; y < h; y++) {
+      spans.clear();
+      Row_Spans(bits + y * stride, w, spans);
+      for (size_t i = 0; i < spans.size(); i++) fprintf(f, "%d %d %d\n", y, spans[i].X0, spans[i].X1);
+   }
+   return fclose(f) == 0;
+}
+
+struct FailBox
+{
+   int X0, Y0, X1, Y1;
+   unsigned long long Pixels;
+};
+
+static int Find_Root(std::vector<int> &parent, int i)
+{
+   while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+   }
+   return i;
+}
+
+static bool Box_Before(const FailBox &a, const FailBox &b)
+{
+   return a.Y0 != b.Y0 ? a.Y0 < b.Y0 : a.X0 < b.X0;
+}
+
+bool Write_Fail_Boxes(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h)
+{
+   // The runs of each row are joined to the runs of the row above that
+   // touch them, diagonally included, with a union-find over all runs
+   std::vector<int> parent;
+   std::vector<FailBox> boxes;
+   std::vector<FailSpan> above, row;
+   int above_first = 0;
+   for (int y = 0; y < h; y++) {
+      row.clear();
+      Row_Spans(bits + y * stride, w, row);
+      const int first = (int) boxes.size();
+      size_t j = 0;
+      for (size_t i = 0; i < row.size(); i++) {
+         const int id = (int) boxes.size();
+         FailBox box = { row[i].X0, y, row[i].X1, y + 1,
+            (unsigned long long) (row[i].X1 - row[i].X0) };
+         boxes.push_back(box);
+         parent.push_back(id);
+         // Runs above that end left of this one cannot touch later ones
+         while (j < above.size() && above[j].X1 < row[i].X0) j++;
+         for (size_t k = j; k < above.size() && above[k].X0 <= row[i].X1; k++) {
+            const int a = Find_Root(parent, above_first + (int) k);
+            const int b = Find_Root(parent, id);
+            if (a == b) continue;
+            parent[b] = a;
+            FailBox &into = boxes[a];
+            const FailBox &from = boxes[b];
+            into.X0 = std::min(into.X0, from.X0);
+            into.Y0 = std::min(into.Y0, from.Y0);
+            into.X1 = std::max(into.X1, from.X1);
+            into.Y1 = std::max(into.Y1, from.Y1);
+            into.Pixels += from.Pixels;
+         }
+      }
+      above.swap(row);
+      above_first = first;
+   }
+
+   std::vector<FailBox> regions;
+   for (int i = 0; i < (int) boxes.size(); i++) {
+      if (Find_Root(parent, i) == i) regions.push_back(boxes[i]);
+   }
+   std::sort(regions.begin(), regions.end(), Box_Before);
+
+   FILE *f = fopen(path, "w");
+   if (!f) return false;
+   for (size_t i = 0; i < regions.size(); i++) {
+      const FailBox &b = regions[i];
+      fprintf(f, "%d %d %d %d %llu\n", b.X0, b.Y0, b.X1, b.Y1, b.Pixels);
+   }
+   return fclose(f) == 0;
+}
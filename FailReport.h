@@ -0,0 +1,42 @@
+/*
+FailReport
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#ifndef _FAILREPORT_H
+#define _FAILREPORT_H
+
+#include <stddef.h>
+
+// Compact reports of the pixels that failed, written from the packed
+// results of a comparison: pixel (x, y) failed if bit 7 - x % 8 of
+// bits[x / 8 + y * stride] is set, the layout of a PBM file. Each returns
+// false if the file cannot be written.
+
+// Binary PBM (P4) of the failed pixels, 1 (black) where a pixel failed
+bool Write_Fail_Mask(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h);
+
+// One "y x0 x1" line per run of failed pixels x0 <= x < x1 of row y
+bool Write_Fail_Spans(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h);
+
+// One "x0 y0 x1 y1 pixels" line per 8-connected region of failed pixels,
+// with its bounds (exclusive at x1 and y1) and number of pixels, in order
+// of the top left pixel
+bool Write_Fail_Boxes(const char *path, const unsigned char *bits, ptrdiff_t stride,
+   int w, int h);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+FileUtil
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#include "FileUtil.h"
+#include "ResultCache.h"
+#include <functional>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+FILE *Open_Temp(const std::string &path, std::string &tmp)
+{
+#ifndef _WIN32
+   tmp = path + ".XXXXXX";
+   const int fd = mkstemp(&tmp[0]);
+   if (fd < 0) return NULL;
+   fchmod(fd, 0644);
+   FILE *f = fdopen(fd, "wb");
+   if (!f) {
+      close(fd);
+      remove(tmp.c_str());
+   }
+   return f;
+#else
+   char suffix[48];
+   sprintf(suffix, ".%x.%x.tmp", (unsigned int) _getpid(),
+      (unsigned int) std::hash<std::thread::id>()(std::this_thread::get_id()));
+   tmp = path + suffix;
+   return fopen(tmp.c_str(), "wb");
+#endif
+}
+
+bool Hash_File(const char *filename, uint64_t &hash)
+{
+   FILE *f = fopen(filename, "rb");
+   if (!f) return false;
+   HashStream stream(0);
+   std::vector<char> chunk(65536);
+   size_t n;
+   while ((n = fread(&chunk[0], 1, chunk.size(), f)) > 0) stream.Update(&chunk[0], n);
+   const bool ok = !ferror(f);
+   fclose(f);
+   hash = stream.Final();
+   return ok;
+}
@@ -0,0 +1,33 @@
+/*
+FileUtil
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#ifndef _FILEUTIL_H
+#define _FILEUTIL_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+
+// Creates a new file next to path to write it under, unique across
+// processes and threads, and returns its name in tmp; NULL if it cannot be
+// created. The caller renames it into place once it is complete.
+FILE *Open_Temp(const std::string &path, std::string &tmp);
+
+// Hash_Bytes of the whole file, read in chunks; false if it cannot be read
+bool Hash_File(const char *filename, uint64_t &hash);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+Half
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _HALF_H
+#define _HALF_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// IEEE 754 half precision (binary16) storage of floats: 11 bits of
+// precision, normal values from 6.1e-5 to 65504. The conversions round to
+// nearest even and keep subnormals, infinities and NaNs. With F16C they
+// compile to the vcvtps2ph and vcvtph2ps instructions, which give the same
+// results as the portable code.
+
+#define HALF_MAX 65504.0f
+
+static inline uint16_t Float_To_Half(float f)
+{
+#if defined(__F16C__)
+   return (uint16_t) _cvtss_sh(f, 0);
+#else
+   uint32_t u;
+   memcpy(&u, &f, sizeof(u));
+   const uint32_t sign = u & 0x80000000u;
+   u ^= sign;
+   uint32_t h;
+   if (u >= (uint32_t) (127 + 16) << 23) {
+      // Too large: infinity, or a quiet NaN
+      h = u > 0x7f800000u ? 0x7e00 : 0x7c00;
+   } else if (u < (uint32_t) (127 - 14) << 23) {
+      // Subnormal or zero: adding 0.5 lines the half's mantissa up with the
+      // bottom bits of the float's, and the FPU does the rounding
+      const uint32_t magic_bits = (uint32_t) (127 - 1) << 23;
+      float magic, sum;
+      memcpy(&magic, &magic_bits, sizeof(magic));
+      memcpy(&sum, &u, sizeof(sum));
+      sum += magic;
+      memcpy(&h, &sum, sizeof(h));
+      h -= magic_bits;
+   } else {
+      // Normal: rebias the exponent and round the 13 dropped bits
+      const uint32_t odd = (u >> 13) & 1;
+      u += ((uint32_t) (15 - 127) << 23) + 0xfff + odd;
+      h = u >> 13;
+   }
+   return (uint16_t) (h | sign >> 16);
+#endif
+}
+
+static inline float Half_To_Float(uint16_t h)
+{
+#if defined(__F16C__)
+   return _cvtsh_ss(h);
+#else
+   uint32_t u = (uint32_t) (h & 0x7fff) << 13;
+   const uint32_t exp = u & (0x7c00u << 13);
+   u += (uint32_t) (127 - 15) << 23;
+   float f;
+   if (exp == 0x7c00u << 13) {
+      // Infinity or NaN
+      u += (uint32_t) (128 - 16) << 23;
+      memcpy(&f, &u, sizeof(f));
+   } else if (exp == 0) {
+      // Subnormal or zero, renormalized by the FPU
+      const uint32_t magic_bits = (uint32_t) (127 - 14) << 23;
+      float magic;
+      memcpy(&magic, &magic_bits, sizeof(magic));
+      u += 1 << 23;
+      memcpy(&f, &u, sizeof(f));
+      f -= magic;
+   } else {
+      memcpy(&f, &u, sizeof(f));
+   }
+   return (h & 0x8000) ? -f : f;
+#endif
+}
+
+// Stores n floats as halves, clamping them to +-HALF_MAX so that large
+// values stay finite; NaNs stay NaNs
+static inline void Floats_To_Halves(uint16_t *out, const float *in, int n)
+{
+   int i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+   const __m256 hi = _mm256_set1_ps(HALF_MAX);
+   const __m256 lo = _mm256_set1_ps(-HALF_MAX);
+   for (; i + 8 <= n; i += 8) {
+      const __m256 v = _mm256_max_ps(lo, _mm256_min_ps(hi, _mm256_loadu_ps(in + i)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm256_cvtps_ph(v, 0));
+   }
+#endif
+   for (; i < n; i++) {
+      const float v = in[i] > HALF_MAX ? HALF_MAX : (in[i] < -HALF_MAX ? -HALF_MAX : in[i]);
+      out[i] = Float_To_Half(v);
+   }
+}
+
+static inline void Halves_To_Floats(float *out, const uint16_t *in, int n)
+{
+   int i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+   for (; i + 8 <= n; i += 8) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      _mm256_storeu_ps(out + i, _mm256_cvtph_ps(v));
+   }
+#endif
+   for (; i < n; i++) out[i] = Half_To_Float(in[i]);
+}
+
+#endif
@@ -15,74 +15,310 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 */
 
 #include "LPyramid.h"
+#include "AlignedBuffer.h"
+#include "ThreadPool.h"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+// The 5 tap filter kernel is symmetric: K0 K1 K2 K1 K0
+static const float K0 = 0.05f;
+static const float K1 = 0.25f;
+static const float K2 = 0.4f;
+
+// Mirrors an out of range coordinate back into [0, n). Matches the
+// boundary handling of the original 25 tap convolution; the final clamp
+// only matters for images narrower than the filter support.
+static inline int Mirror(int i, int n)
+{
+   if (i < 0) i = -i;
+   if (i >= n) i = 2 * n - i - 1;
+   if (i < 0) i = 0;
+   if (i >= n) i = n - 1;
+   return i;
+}
+
+// out[x] = K0 * (r0 + r4) + K1 * (r1 + r3) + K2 * r2 for one row of n values
+static void Convolve_Vertical(float *out, const float *const r[5], int n)
+{
+   int x = 0;
+#if defined(__AVX__)
+   const __m256 k0 = _mm256_set1_ps(K0);
+   const __m256 k1 = _mm256_set1_ps(K1);
+   const __m256 k2 = _mm256_set1_ps(K2);
+   for (; x + 8 <= n; x += 8) {
+      __m256 o = _mm256_add_ps(_mm256_loadu_ps(r[0] + x), _mm256_loadu_ps(r[4] + x));
+      __m256 i = _mm256_add_ps(_mm256_loadu_ps(r[1] + x), _mm256_loadu_ps(r[3] + x));
+      __m256 s = _mm256_add_ps(_mm256_mul_ps(k0, o), _mm256_mul_ps(k1, i));
+      s = _mm256_add_ps(s, _mm256_mul_ps(k2, _mm256_loadu_ps(r[2] + x)));
+      _mm256_storeu_ps(out + x, s);
+   }
+#endif
+#if defined(__SSE__) || defined(_M_X64)
+   const __m128 q0 = _mm_set1_ps(K0);
+   const __m128 q1 = _mm_set1_ps(K1);
+   const __m128 q2 = _mm_set1_ps(K2);
+   for (; x + 4 <= n; x += 4) {
+      __m128 o = _mm_add_ps(_mm_loadu_ps(r[0] + x), _mm_loadu_ps(r[4] + x));
+      __m128 i = _mm_add_ps(_mm_loadu_ps(r[1] + x), _mm_loadu_ps(r[3] + x));
+      __m128 s = _mm_add_ps(_mm_mul_ps(q0, o), _mm_mul_ps(q1, i));
+      s = _mm_add_ps(s, _mm_mul_ps(q2, _mm_loadu_ps(r[2] + x)));
+      _mm_storeu_ps(out + x, s);
+   }
+#endif
+   for (; x < n; x++) {
+      out[x] = K0 * (r[0][x] + r[4][x]) + K1 * (r[1][x] + r[3][x]) + K2 * r[2][x];
+   }
+}
+
+// Horizontal pass over out[x0..x1) of a row of n values. Only in[x0-2..x1+2)
+// is read, mirrored at the ends of the row.
+static void Convolve_Horizontal(float *out, const float *in, int n, int x0, int x1)
+{
+   // Border path: mirrored taps near either edge
+   int lo = (x1 < 2) ? x1 : 2;
+   int hi = (n - 2 > lo) ? n - 2 : lo;
+   if (lo < x0) lo = x0;
+   if (hi > x1) hi = x1;
+   if (hi < lo) hi = lo;
+   for (int x = x0; x < lo; x++) {
+      out[x] = K0 * (in[Mirror(x - 2, n)] + in[Mirror(x + 2, n)]) +
+               K1 * (in[Mirror(x - 1, n)] + in[Mirror(x + 1, n)]) + K2 * in[x];
+   }
+   for (int x = hi; x < x1; x++) {
+      out[x] = K0 * (in[Mirror(x - 2, n)] + in[Mirror(x + 2, n)]) +
+               K1 * (in[Mirror(x - 1, n)] + in[Mirror(x + 1, n)]) + K2 * in[x];
+   }
+
+   // Interior fast path: every tap is in range, no branches
+   int x = lo;
+#if defined(__AVX__)
+   const __m256 k0 = _mm256_set1_ps(K0);
+   const __m256 k1 = _mm256_set1_ps(K1);
+   const __m256 k2 = _mm256_set1_ps(K2);
+   for (; x + 8 <= hi; x += 8) {
+      __m256 o = _mm256_add_ps(_mm256_loadu_ps(in + x - 2), _mm256_loadu_ps(in + x + 2));
+      __m256 i = _mm256_add_ps(_mm256_loadu_ps(in + x - 1), _mm256_loadu_ps(in + x + 1));
+      __m256 s = _mm256_add_ps(_mm256_mul_ps(k0, o), _mm256_mul_ps(k1, i));
+      s = _mm256_add_ps(s, _mm256_mul_ps(k2, _mm256_loadu_ps(in + x)));
+      _mm256_storeu_ps(out + x, s);
+   }
+#endif
+#if defined(__SSE__) || defined(_M_X64)
+   const __m128 q0 = _mm_set1_ps(K0);
+   const __m128 q1 = _mm_set1_ps(K1);
+   const __m128 q2 = _mm_set1_ps(K2);
+   for (; x + 4 <= hi; x += 4) {
+      __m128 o = _mm_add_ps(_mm_loadu_ps(in + x - 2), _mm_loadu_ps(in + x + 2));
+      __m128 i = _mm_add_ps(_mm_loadu_ps(in + x - 1), _mm_loadu_ps(in + x + 1));
+      __m128 s = _mm_add_ps(_mm_mul_ps(q0, o), _mm_mul_ps(q1, i));
+      s = _mm_add_ps(s, _mm_mul_ps(q2, _mm_loadu_ps(in + x)));
+      _mm_storeu_ps(out + x, s);
+   }
+#endif
+   for (; x < hi; x++) {
+      out[x] = K0 * (in[x - 2] + in[x + 2]) + K1 * (in[x - 1] + in[x + 1]) + K2 * in[x];
+   }
+}
 
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
 
+LPyramid::LPyramid() :
+   Width(0),
+   Height(0),
+   Decimated(false),
+   Half(false),
+   Wrapped(false),
+   RowCapacity(0),
+   Row(0)
+{
+   for (int i=0; i<MAX_PYR_LEVELS; i++) {
+      Levels[i] = 0;
+      LevelCapacity[i] = 0;
+      HalfLevels[i] = 0;
+      HalfCapacity[i] = 0;
+   }
+}
+
 LPyramid::LPyramid(float *image, int width, int height) :
-   Width(width),
-   Height(height)
+   Width(0),
+   Height(0),
+   Decimated(false),
+   Half(false),
+   Wrapped(false),
+   RowCapacity(0),
+   Row(0)
 {
-   // Make the Laplacian pyramid by successively
-   // copying the earlier levels and blurring them
    for (int i=0; i<MAX_PYR_LEVELS; i++) {
-      if (i == 0) {
-         Levels[i] = Copy(image);
-      } else {
-         Levels[i] = new float[Width * Height];
-         Convolve(Levels[i], Levels[i - 1]);
-      }
+      Levels[i] = 0;
+      LevelCapacity[i] = 0;
+      HalfLevels[i] = 0;
+      HalfCapacity[i] = 0;
    }
+   Resize(width, height);
+   float *base = Get_Base();
+   for (int i = 0; i < width * height; i++) base[i] = image[i];
+   Build(0, 0, width, height);
 }
 
 LPyramid::~LPyramid()
 {
    for (int i=0; i<MAX_PYR_LEVELS; i++) {
-      if (Levels[i]) delete Levels[i];
+      if (!Wrapped) Aligned_Free(Levels[i], LevelCapacity[i] * sizeof(float));
+      Aligned_Free(HalfLevels[i], HalfCapacity[i] * sizeof(uint16_t));
    }
+   Aligned_Free(Row, RowCapacity * sizeof(float));
 }
 
-float *LPyramid::Copy(float *img)
+void LPyramid::Wrap(float *const levels[MAX_PYR_LEVELS], int stride, int height)
 {
-   int max = Width * Height;
-   float *out = new float[max];
-   for (int i = 0; i < max; i++) out[i] = img[i];
+   for (int i=0; i<MAX_PYR_LEVELS; i++) {
+      if (!Wrapped) Aligned_Free(Levels[i], LevelCapacity[i] * sizeof(float));
+      Levels[i] = levels[i];
+      LevelWidth[i] = stride;
+      LevelHeight[i] = height;
+      LevelCapacity[i] = 0;
+   }
+   Width = stride;
+   Height = height;
+   Decimated = false;
+   Half = false;
+   Wrapped = true;
+}
 
-   return out;
+size_t LPyramid::Get_Memory() const
+{
+   size_t floats = RowCapacity;
+   size_t halves = 0;
+   for (int i=0; i<MAX_PYR_LEVELS; i++) {
+      floats += LevelCapacity[i];
+      halves += HalfCapacity[i];
+   }
+   return floats * sizeof(float) + halves * sizeof(uint16_t);
+}
+
+void LPyramid::Resize(int width, int height, bool decimated, bool half)
+{
+   if (Wrapped) {
+      for (int i=0; i<MAX_PYR_LEVELS; i++) Levels[i] = 0;
+      Wrapped = false;
+   }
+   Width = width;
+   Height = height;
+   Decimated = decimated;
+   Half = half && !decimated;
+   for (int i=0; i<MAX_PYR_LEVELS; i++) {
+      if (i == 0 || !Decimated) {
+         LevelWidth[i] = Width;
+         LevelHeight[i] = Height;
+      } else {
+         LevelWidth[i] = (LevelWidth[i - 1] + 1) / 2;
+         LevelHeight[i] = (LevelHeight[i - 1] + 1) / 2;
+      }
+      int size = LevelWidth[i] * LevelHeight[i];
+      if (Half && i > 0 && size > HalfCapacity[i]) {
+         Aligned_Free(HalfLevels[i], HalfCapacity[i] * sizeof(uint16_t));
+         HalfLevels[i] = 0;
+         HalfCapacity[i] = 0;
+         HalfLevels[i] = static_cast<uint16_t *>(Aligned_Alloc(size * sizeof(uint16_t)));
+         HalfCapacity[i] = size;
+      }
+      if (Half && i > 2) continue;
+      if (size > LevelCapacity[i]) {
+         // Emptied first, in case the allocation throws
+         Aligned_Free(Levels[i], LevelCapacity[i] * sizeof(float));
+         Levels[i] = 0;
+         LevelCapacity[i] = 0;
+         Levels[i] = static_cast<float *>(Aligned_Alloc(size * sizeof(float)));
+         LevelCapacity[i] = size;
+      }
+   }
+   if (Width > RowCapacity) {
+      Aligned_Free(Row, RowCapacity * sizeof(float));
+      Row = 0;
+      RowCapacity = 0;
+      Row = static_cast<float *>(Aligned_Alloc(Width * sizeof(float)));
+      RowCapacity = Width;
+   }
 }
 
-void LPyramid::Convolve(float *a, float *b)
-// convolves image b with the filter kernel and stores it in a
+void LPyramid::Build(int x0, int y0, int x1, int y1)
 {
-   int y,x,i,j,nx,ny;
-   const float Kernel[] = {0.05f, 0.25f, 0.4f, 0.25f, 0.05f};
-
-   for (y=0; y<Height; y++) {
-      for (x=0; x<Width; x++) {
-         int index = y * Width + x;
-         a[index] = 0.0f;
-         for (i=-2; i<=2; i++) {
-            for (j=-2; j<=2; j++) {
-               nx=x+i;
-               ny=y+j;
-               if (nx<0) nx=-nx;
-               if (ny<0) ny=-ny;
-               if (nx>=Width) nx=2*Width-nx-1;
-               if (ny>=Height) ny=2*Height-ny-1;
-               a[index] += Kernel[i+2] * Kernel[j+2] * b[ny * Width + nx];
-            }
-         }
+   // Make the Laplacian pyramid by successively blurring the earlier
+   // levels. Level i must stay valid 2 pixels further out than level i+1.
+   for (int i=1; i<MAX_PYR_LEVELS; i++) {
+      int grow = 2 * (MAX_PYR_LEVELS - 1 - i);
+      int bx0 = x0 - grow > 0 ? x0 - grow : 0;
+      int by0 = y0 - grow > 0 ? y0 - grow : 0;
+      int bx1 = x1 + grow < Width ? x1 + grow : Width;
+      int by1 = y1 + grow < Height ? y1 + grow : Height;
+      if (!Half) {
+         Convolve(Levels[i], Levels[i - 1], bx0, by0, bx1, by1);
+         continue;
+      }
+      float *below = i == 1 ? Levels[0] : Levels[1 + i % 2];
+      float *level = Levels[1 + (i + 1) % 2];
+      Convolve(level, below, bx0, by0, bx1, by1);
+      for (int y = by0; y < by1; y++) {
+         Floats_To_Halves(HalfLevels[i] + bx0 + y * Width, level + bx0 + y * Width, bx1 - bx0);
       }
    }
 }
 
-float LPyramid::Get_Value(int x, int y, int level)
+void LPyramid::Convolve(float *a, float *b, int x0, int y0, int x1, int y1)
+// convolves image b with the filter kernel and stores [x0, x1) x [y0, y1) of it in a
 {
-   int index = x + y * Width;
-   int l = level;
-   if (l > MAX_PYR_LEVELS) l = MAX_PYR_LEVELS;
-   return Levels[level][index];
+   // The kernel is separable, so each output row is the horizontal
+   // pass over the vertically filtered (mirrored) input rows.
+   int lo = x0 - 2 > 0 ? x0 - 2 : 0;
+   int hi = x1 + 2 < Width ? x1 + 2 : Width;
+   for (int y = y0; y < y1; y++) {
+      const float *r[5];
+      for (int j = 0; j < 5; j++) {
+         r[j] = b + Mirror(y + j - 2, Height) * Width + lo;
+      }
+      Convolve_Vertical(Row + lo, r, hi - lo);
+      Convolve_Horizontal(a + y * Width, Row, Width, x0, x1);
+   }
+}
+
+void LPyramid::Build_Decimated(ThreadPool *pool)
+{
+   for (int i=1; i<MAX_PYR_LEVELS; i++) {
+      if (pool) {
+         pool->Parallel_For(0, LevelHeight[i], [this, i](int y0, int y1) {
+            AlignedFloats row(LevelWidth[i - 1]);
+            Reduce(i, y0, y1, &row[0]);
+         });
+      } else {
+         Reduce(i, 0, LevelHeight[i], Row);
+      }
+   }
 }
 
+void LPyramid::Reduce(int level, int y0, int y1, float *row)
+// blurs level - 1 and keeps every other sample of rows [y0, y1) of level
+{
+   const float *b = Levels[level - 1];
+   const int bw = LevelWidth[level - 1];
+   const int bh = LevelHeight[level - 1];
+   const int w = LevelWidth[level];
+   for (int y = y0; y < y1; y++) {
+      const float *r[5];
+      for (int j = 0; j < 5; j++) {
+         r[j] = b + Mirror(2 * y + j - 2, bh) * bw;
+      }
+      Convolve_Vertical(row, r, bw);
+      float *a = Levels[level] + y * w;
+      for (int x = 0; x < w; x++) {
+         int c = 2 * x;
+         a[x] = K0 * (row[Mirror(c - 2, bw)] + row[Mirror(c + 2, bw)]) +
+                K1 * (row[Mirror(c - 1, bw)] + row[Mirror(c + 1, bw)]) + K2 * row[c];
+      }
+   }
+}
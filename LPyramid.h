@@ -16,24 +16,120 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 #ifndef _LPYRAMID_H
 #define _LPYRAMID_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "Half.h"
+
 #define MAX_PYR_LEVELS 8
 
+class ThreadPool;
+
+// Each level blurs the previous one with a 5 tap kernel, so a pixel of the
+// last level depends on input pixels up to this far away.
+#define PYR_HALO (2 * (MAX_PYR_LEVELS - 1))
+
+// The pyramid can cover just a window of a larger image. Windows that touch
+// an image edge mirror at that edge exactly as the whole image would, so a
+// window extending PYR_HALO pixels past a core rectangle (or up to the image
+// edge) yields the same values over the core as a pyramid of the full image.
+//
+// A decimated pyramid instead halves the resolution at every level, like a
+// classic Burt-Adelson Gaussian pyramid, and always covers the whole image.
+// Its levels take 1.33 times the memory of the image rather than
+// MAX_PYR_LEVELS times, and Get_Value() bilinearly upsamples them back to
+// full resolution.
+//
+// A half precision pyramid stores levels 1 and up as 16-bit floats, which
+// halves the memory Get_Value() reads them from. They are still blurred in
+// float, from a float copy of the level below.
 class LPyramid
 {
 public:
+   LPyramid();
+   // Pyramid of a whole width x height image
    LPyramid(float *image, int width, int height);
    virtual ~LPyramid();
-   float Get_Value(int x, int y, int level);
+
+   // Sets the window size, keeping the level buffers when they are big
+   // enough. Decimated pyramids are never half precision.
+   void Resize(int width, int height, bool decimated = false, bool half = false);
+   // Level 0 of the window, filled in by the caller before Build()
+   float *Get_Base() { return Levels[0]; }
+   // Only level 0 of a half precision pyramid is a float level
+   const float *Get_Level(int level) const { return Levels[level]; }
+   // Bytes of the buffers it allocated
+   size_t Get_Memory() const;
+   // Blurs the remaining levels. Only the part of each level that feeds the
+   // core rectangle [x0, x1) x [y0, y1) (window coordinates) is computed.
+   void Build(int x0, int y0, int x1, int y1);
+   // Blurs and subsamples the remaining levels of a decimated pyramid,
+   // splitting the rows of each level over the pool when one is given
+   void Build_Decimated(ThreadPool *pool = 0);
+   // Uses levels kept elsewhere, e.g. in a reference cache, instead of
+   // building them. Pixel (x, y) of level l is levels[l][x + y * stride];
+   // only the values may be read until the next Resize().
+   void Wrap(float *const levels[MAX_PYR_LEVELS], int stride, int height);
+
+   int Get_Width() const { return Width; }
+
+   // Pixel (x, y) of a level, whatever the pyramid's kind
+   float Get_Value(int x, int y, int level) const
+   {
+      if (Half) return Get_Half_Value(x + y * Width, level);
+      if (Decimated) return Get_Decimated_Value(x, y, level);
+      return Get_Float_Value(x + y * Width, level);
+   }
+   // The same for a pyramid known to be of one kind; i is x + y * Get_Width()
+   float Get_Float_Value(int i, int level) const { return Levels[level][i]; }
+   float Get_Half_Value(int i, int level) const
+   {
+      return level > 0 ? Half_To_Float(HalfLevels[level][i]) : Levels[0][i];
+   }
+   float Get_Decimated_Value(int x, int y, int level) const
+   {
+      if (level == 0) return Levels[0][x + y * Width];
+      // Sample i of a decimated level sits on full resolution pixel i << level
+      const int w = LevelWidth[level];
+      const int h = LevelHeight[level];
+      const float scale = 1.0f / (1 << level);
+      float fx = x * scale;
+      float fy = y * scale;
+      int x0 = (int) fx;
+      int y0 = (int) fy;
+      int x1 = x0 + 1 < w ? x0 + 1 : w - 1;
+      int y1 = y0 + 1 < h ? y0 + 1 : h - 1;
+      float tx = fx - x0;
+      float ty = fy - y0;
+      const float *l = Levels[level];
+      float top = l[x0 + y0 * w] + tx * (l[x1 + y0 * w] - l[x0 + y0 * w]);
+      float bottom = l[x0 + y1 * w] + tx * (l[x1 + y1 * w] - l[x0 + y1 * w]);
+      return top + ty * (bottom - top);
+   }
 protected:
-   float *Copy(float *img);
-   void Convolve(float *a, float *b);
+   // Separable 5 tap blur of b into a over [x0, x1) x [y0, y1), with
+   // mirrored boundaries. Agrees with the direct 25 tap convolution to
+   // within 1e-6 relative error per level (the kernel weights are positive
+   // and sum to one, so only the summation order differs).
+   void Convolve(float *a, float *b, int x0, int y0, int x1, int y1);
+   void Reduce(int level, int y0, int y1, float *row);
 
    // Succesively blurred versions of the original image
    float *Levels[MAX_PYR_LEVELS];
+   int LevelWidth[MAX_PYR_LEVELS];
+   int LevelHeight[MAX_PYR_LEVELS];
+   int LevelCapacity[MAX_PYR_LEVELS];
+   // Levels 1 and up of a half precision pyramid; its float levels 1 and 2
+   // then take turns holding the level being blurred
+   uint16_t *HalfLevels[MAX_PYR_LEVELS];
+   int HalfCapacity[MAX_PYR_LEVELS];
 
    int Width;
    int Height;
+   bool Decimated;
+   bool Half;
+   bool Wrapped;
+   int RowCapacity;
+   float *Row;
 };
 
 #endif // _LPYRAMID_H
-
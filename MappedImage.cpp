@@ -0,0 +1,378 @@
+/*
+MappedImage
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "MappedImage.h"
+#include "AlignedBuffer.h"
+#include "RGBAImage.h"
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of a whole file, mapped where mmap is available
+class MappedFile
+{
+   MappedFile(const MappedFile&);
+   MappedFile& operator=(const MappedFile&);
+
+public:
+   MappedFile() : Data(0), Size(0), Mapping(0) {}
+   ~MappedFile();
+   bool Open(const char *path);
+
+   const unsigned char *Data;
+   size_t Size;
+
+private:
+   void *Mapping;
+   std::vector<unsigned char> Memory;
+};
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+   if (Mapping) munmap(Mapping, Size);
+#endif
+}
+
+bool MappedFile::Open(const char *path)
+{
+#ifndef _WIN32
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) return false;
+   struct stat st;
+   void *m = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size > 0)
+      m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m == MAP_FAILED) return false;
+   // The kernel reads the file ahead in the background, so the comparison
+   // can convert the first rows while the later ones are still arriving
+   posix_madvise(m, st.st_size, POSIX_MADV_WILLNEED);
+   Mapping = m;
+   Size = st.st_size;
+   Data = static_cast<const unsigned char *>(m);
+   return true;
+#else
+   FILE *f = fopen(path, "rb");
+   if (!f) return false;
+   fseek(f, 0, SEEK_END);
+   const long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   bool ok = size > 0;
+   if (ok) {
+      Memory.resize(size);
+      ok = fread(&Memory[0], 1, size, f) == (size_t) size;
+   }
+   fclose(f);
+   if (!ok) return false;
+   Size = size;
+   Data = &Memory[0];
+   return true;
+#endif
+}
+
+// Where the pixels are in a file and how they are stored. The rows follow
+// each other from DataOffset on, top to bottom unless BottomUp is set.
+struct PixelLayout
+{
+   int Width;
+   int Height;
+   PixelType Type;
+   int Channels;
+   int Offset[4];
+   size_t DataOffset;
+   bool BottomUp;
+};
+
+static bool Host_Is_Little_Endian()
+{
+   const uint16_t one = 1;
+   return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+// Component offsets of grey, grey + alpha, RGB and RGBA pixels
+static bool Set_Channels(PixelLayout &layout, int channels)
+{
+   static const int offsets[4][4] = {
+      { 0, 0, 0, -1 }, { 0, 0, 0, 1 }, { 0, 1, 2, -1 }, { 0, 1, 2, 3 }
+   };
+   if (channels < 1 || channels > 4) return false;
+   layout.Channels = channels;
+   for (int i = 0; i < 4; i++) layout.Offset[i] = offsets[channels - 1][i];
+   return true;
+}
+
+// Skips whitespace and comments, then reads a word of at most size - 1 characters
+static bool PNM_Word(const MappedFile &f, size_t &pos, char *word, size_t size)
+{
+   while (pos < f.Size && (isspace(f.Data[pos]) || f.Data[pos] == '#')) {
+      if (f.Data[pos] == '#') {
+         while (pos < f.Size && f.Data[pos] != '\n') pos++;
+      } else {
+         pos++;
+      }
+   }
+   size_t n = 0;
+   while (pos < f.Size && !isspace(f.Data[pos])) {
+      if (n + 1 >= size) return false;
+      word[n++] = f.Data[pos++];
+   }
+   word[n] = 0;
+   return n > 0;
+}
+
+static bool PNM_Number(const MappedFile &f, size_t &pos, int &value)
+{
+   char word[16];
+   if (!PNM_Word(f, pos, word, sizeof(word))) return false;
+   char *end;
+   const long v = strtol(word, &end, 10);
+   if (*end || v < 0 || v > INT_MAX) return false;
+   value = (int) v;
+   return true;
+}
+
+// Binary PGM (P5), PPM (P6) and PAM (P7)
+static bool Parse_PNM(const MappedFile &f, PixelLayout &layout)
+{
+   const char kind = f.Data[1];
+   size_t pos = 2;
+   int channels = kind == '5' ? 1 : 3;
+   int maxval = 0;
+   if (kind == '7') {
+      char word[16];
+      layout.Width = layout.Height = channels = 0;
+      for (;;) {
+         if (!PNM_Word(f, pos, word, sizeof(word))) return false;
+         if (!strcmp(word, "ENDHDR")) break;
+         bool ok = true;
+         if (!strcmp(word, "WIDTH")) ok = PNM_Number(f, pos, layout.Width);
+         else if (!strcmp(word, "HEIGHT")) ok = PNM_Number(f, pos, layout.Height);
+         else if (!strcmp(word, "DEPTH")) ok = PNM_Number(f, pos, channels);
+         else if (!strcmp(word, "MAXVAL")) ok = PNM_Number(f, pos, maxval);
+         else while (pos < f.Size && f.Data[pos] != '\n') pos++;  // TUPLTYPE
+         if (!ok) return false;
+      }
+      while (pos < f.Size && f.Data[pos] != '\n') pos++;
+   } else {
+      if (!PNM_Number(f, pos, layout.Width) || !PNM_Number(f, pos, layout.Height) ||
+            !PNM_Number(f, pos, maxval)) {
+         return false;
+      }
+   }
+   // A single whitespace character separates the header from the pixels
+   if (pos >= f.Size || !isspace(f.Data[pos])) return false;
+   layout.DataOffset = pos + 1;
+   layout.BottomUp = false;
+
+   // Samples are big endian, so 16 bit ones are used in place only on big
+   // endian hosts; other maxvals would need rescaling
+   if (maxval == 255) layout.Type = PIXEL_UINT8;
+   else if (maxval == 65535 && !Host_Is_Little_Endian()) layout.Type = PIXEL_UINT16;
+   else return false;
+   return Set_Channels(layout, channels);
+}
+
+// PF (RGB) and Pf (grey) float maps. The sign of the scale gives the byte
+// order, and the rows are stored bottom to top.
+static bool Parse_PFM(const MappedFile &f, PixelLayout &layout)
+{
+   size_t pos = 2;
+   char word[32];
+   if (!PNM_Number(f, pos, layout.Width) || !PNM_Number(f, pos, layout.Height) ||
+         !PNM_Word(f, pos, word, sizeof(word))) {
+      return false;
+   }
+   char *end;
+   const double scale = strtod(word, &end);
+   if (*end || scale == 0 || (scale < 0) != Host_Is_Little_Endian()) return false;
+   if (pos >= f.Size || !isspace(f.Data[pos])) return false;
+   layout.DataOffset = pos + 1;
+   layout.BottomUp = true;
+   layout.Type = PIXEL_FLOAT;
+   return Set_Channels(layout, f.Data[1] == 'F' ? 3 : 1);
+}
+
+// Value i of the SHORT or LONG field of the TIFF directory entry at entry
+static bool TIFF_Value(const MappedFile &f, size_t entry, uint32_t i, uint32_t &value)
+{
+   uint16_t type;
+   uint32_t count;
+   memcpy(&type, f.Data + entry + 2, 2);
+   memcpy(&count, f.Data + entry + 4, 4);
+   const size_t size = type == 3 ? 2 : type == 4 ? 4 : 0;
+   if (!size || i >= count) return false;
+
+   // Values that do not fit in the entry are stored elsewhere
+   uint64_t pos = entry + 8;
+   if ((uint64_t) count * size > 4) {
+      uint32_t offset;
+      memcpy(&offset, f.Data + pos, 4);
+      pos = offset;
+   }
+   pos += (uint64_t) i * size;
+   if (pos + size > f.Size) return false;
+   if (size == 2) {
+      uint16_t v;
+      memcpy(&v, f.Data + pos, 2);
+      value = v;
+   } else {
+      memcpy(&value, f.Data + pos, 4);
+   }
+   return true;
+}
+
+// Uncompressed, chunky TIFF in the byte order of the host whose strips
+// follow each other, so that the first IFD is one top to bottom image
+static bool Parse_TIFF(const MappedFile &f, PixelLayout &layout)
+{
+   if (f.Size < 8 || memcmp(f.Data, Host_Is_Little_Endian() ? "II" : "MM", 2) != 0) return false;
+   uint32_t ifd;
+   uint16_t entries;
+   memcpy(&ifd, f.Data + 4, 4);
+   if ((uint64_t) ifd + 2 > f.Size) return false;
+   memcpy(&entries, f.Data + ifd, 2);
+   if ((uint64_t) ifd + 2 + entries * 12 > f.Size) return false;
+
+   enum { WIDTH, HEIGHT, BITS, COMPRESSION, PHOTOMETRIC, STRIPS, ORIENTATION, SAMPLES,
+      ROWS_PER_STRIP, PLANAR, SAMPLE_FORMAT, NUM_TAGS };
+   static const uint16_t tags[NUM_TAGS] = { 256, 257, 258, 259, 262, 273, 274, 277, 278, 284, 339 };
+   size_t entry[NUM_TAGS] = { 0 };
+   for (int e = 0; e < entries; e++) {
+      const size_t pos = ifd + 2 + e * 12;
+      uint16_t tag;
+      memcpy(&tag, f.Data + pos, 2);
+      if (tag == 322) return false;  // tiled
+      for (int t = 0; t < NUM_TAGS; t++) {
+         if (tag == tags[t]) entry[t] = pos;
+      }
+   }
+
+   // Missing fields take their default value, except for the required ones
+   uint32_t value[NUM_TAGS] = { 0, 0, 1, 1, 0, 0, 1, 1, UINT32_MAX, 1, 1 };
+   for (int t = 0; t < NUM_TAGS; t++) {
+      if (entry[t] && !TIFF_Value(f, entry[t], 0, value[t])) return false;
+   }
+   if (!entry[WIDTH] || !entry[HEIGHT] || !entry[PHOTOMETRIC] || !entry[STRIPS]) return false;
+   const uint32_t samples = value[SAMPLES];
+   if (value[COMPRESSION] != 1 || value[ORIENTATION] != 1 || (value[PLANAR] != 1 && samples > 1))
+      return false;
+   if (value[PHOTOMETRIC] == 1 ? samples > 2 : value[PHOTOMETRIC] != 2 || samples < 3)
+      return false;
+   if (value[WIDTH] > INT_MAX || value[HEIGHT] > INT_MAX || !Set_Channels(layout, samples))
+      return false;
+   layout.Width = value[WIDTH];
+   layout.Height = value[HEIGHT];
+
+   // Every sample has the same size and format
+   for (uint32_t s = 1; s < samples; s++) {
+      uint32_t v;
+      if (entry[BITS] && (!TIFF_Value(f, entry[BITS], s, v) || v != value[BITS])) return false;
+      if (entry[SAMPLE_FORMAT] && (!TIFF_Value(f, entry[SAMPLE_FORMAT], s, v) ||
+            v != value[SAMPLE_FORMAT])) {
+         return false;
+      }
+   }
+   size_t size;
+   if (value[BITS] == 8 && value[SAMPLE_FORMAT] == 1) {
+      layout.Type = PIXEL_UINT8;
+      size = 1;
+   } else if (value[BITS] == 16 && value[SAMPLE_FORMAT] == 1) {
+      layout.Type = PIXEL_UINT16;
+      size = 2;
+   } else if (value[BITS] == 32 && value[SAMPLE_FORMAT] == 3) {
+      layout.Type = PIXEL_FLOAT;
+      size = 4;
+   } else {
+      return false;
+   }
+
+   // The strips must be contiguous; their byte counts are not needed
+   const uint64_t strip_rows = value[ROWS_PER_STRIP] ? value[ROWS_PER_STRIP] : 1;
+   const uint64_t strip_bytes = strip_rows * layout.Width * samples * size;
+   const uint64_t num_strips = (layout.Height + strip_rows - 1) / strip_rows;
+   for (uint64_t s = 1; s < num_strips; s++) {
+      uint32_t offset;
+      if (!TIFF_Value(f, entry[STRIPS], s, offset) || offset != value[STRIPS] + s * strip_bytes)
+         return false;
+   }
+   layout.DataOffset = value[STRIPS];
+   layout.BottomUp = false;
+   return true;
+}
+
+// Checks that the pixels lie within the file and makes an image reading
+// them in place
+static RGBAFloatImage *Make_Image(const char *filename, const std::shared_ptr<MappedFile> &file,
+   const PixelLayout &layout)
+{
+   const size_t size = layout.Type == PIXEL_UINT8 ? 1 : layout.Type == PIXEL_UINT16 ? 2 : 4;
+   const uint64_t row = (uint64_t) layout.Width * layout.Channels * size;
+   const uint64_t bytes = row * layout.Height;
+   if (layout.Width <= 0 || layout.Height <= 0 ||
+         (uint64_t) layout.Width * layout.Height > INT_MAX ||
+         layout.DataOffset > file->Size || bytes > file->Size - layout.DataOffset) {
+      return NULL;
+   }
+
+   std::shared_ptr<void> owner = file;
+   const unsigned char *data = file->Data + layout.DataOffset;
+   // The mapping is page aligned, but a header may leave 16 bit or float
+   // samples misaligned; only then are the pixels copied
+   if (layout.DataOffset % size != 0) {
+      std::shared_ptr<float> copy = Aligned_Shared<float>((bytes + 3) / 4);
+      memcpy(copy.get(), data, bytes);
+      owner = copy;
+      data = reinterpret_cast<const unsigned char *>(copy.get());
+   }
+   const unsigned char *top = layout.BottomUp ? data + (layout.Height - 1) * row : data;
+   const ptrdiff_t stride = layout.BottomUp ? -(ptrdiff_t) row : (ptrdiff_t) row;
+   return new RGBAFloatImage(layout.Width, layout.Height, filename, layout.Type,
+      layout.Channels, layout.Offset, top, stride, owner);
+}
+
+RGBAFloatImage *Read_Mapped_Image(const char *filename)
+{
+   // Only files that look like one of the formats are mapped
+   unsigned char magic[4] = { 0 };
+   FILE *f = fopen(filename, "rb");
+   if (!f) return NULL;
+   const size_t n = fread(magic, 1, sizeof(magic), f);
+   fclose(f);
+   const bool pnm = n >= 2 && magic[0] == 'P' && strchr("567Ff", magic[1]) && magic[1];
+   const bool pfm = pnm && (magic[1] == 'F' || magic[1] == 'f');
+   const bool tiff = n == 4 && (!memcmp(magic, "II*\0", 4) || !memcmp(magic, "MM\0*", 4));
+   if (!pnm && !tiff) return NULL;
+
+   std::shared_ptr<MappedFile> file(new MappedFile);
+   if (!file->Open(filename)) return NULL;
+   PixelLayout layout;
+   const bool ok = tiff ? Parse_TIFF(*file, layout) :
+      pfm ? Parse_PFM(*file, layout) : Parse_PNM(*file, layout);
+   return ok ? Make_Image(filename, file, layout) : NULL;
+}
@@ -0,0 +1,31 @@
+/*
+MappedImage
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _MAPPEDIMAGE_H
+#define _MAPPEDIMAGE_H
+
+class RGBAFloatImage;
+
+// Loads an image whose pixels can be used straight from the file, which is
+// mapped into memory and read in place:
+//   binary PGM/PPM/PAM with a maxval of 255 (65535 on big endian hosts)
+//   PFM in the byte order of the host
+//   uncompressed, contiguous TIFF with 8 or 16 bit integer or 32 bit
+//   float samples in the byte order of the host
+// Returns NULL for any other file, which is then left to FreeImage.
+RGBAFloatImage *Read_Mapped_Image(const char *filename);
+
+#endif
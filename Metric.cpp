@@ -18,8 +18,22 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 #include "Metric.h"
 #include "CompareArgs.h"
 #include "RGBAImage.h"
+#include "AlignedBuffer.h"
 #include "LPyramid.h"
+#include "Half.h"
+#include "ColorSpace.h"
+#include "FailReport.h"
+#include "ThreadPool.h"
+#include "RefCache.h"
+#include "ResultCache.h"
+#include "Stats.h"
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 #ifndef M_PI
 #define M_PI 3.14159265f
@@ -86,150 +100,219 @@ float mask(float contrast)
       return result;
 }
 
-// convert Adobe RGB (1998) with reference white D65 to XYZ
-void AdobeRGBToXYZ(float r, float g, float b, float &x, float &y, float &z)
-{
-   // matrix is from http://www.brucelindbloom.com/
-   x = r * 0.576700f + g * 0.185556f + b * 0.188212f;
-   y = r * 0.297361f + g * 0.627355f + b * 0.0752847f;
-   z = r * 0.0270328f + g * 0.0706879f + b * 0.991248f;
-}
+// Side of the square tiles the comparison is split into. Each tile is
+// converted and blurred together with a PYR_HALO border, so this trades the
+// halo overhead against the size of the per thread working set.
+#define TILE_SIZE 256
+static_assert(TILE_SIZE % 8 == 0, "tiles must start on whole bytes of FailBits");
+
+struct MetricConstants;
+struct TileBuffers;
 
-void XYZToLAB(float x, float y, float z, float &L, float &A, float &B)
+// A variant of the per-pixel test, see Test_Tile()
+typedef unsigned int (*TileTest)(CompareArgs &args, const MetricConstants &mc,
+   const LPyramid *la, const LPyramid *lb, int ox, int oy, const TileBuffers &buf,
+   int x0, int y0, int x1, int y1);
+
+// Per comparison constants of the per-pixel test
+struct MetricConstants
 {
-   static float xw = -1;
-   static float yw;
-   static float zw;
-   // reference white
-   if (xw < 0) {
-      AdobeRGBToXYZ(1, 1, 1, xw, yw, zw);
-   }
-   const float epsilon  = 216.0f / 24389.0f;
-   const float kappa = 24389.0f / 27.0f;
-   float f[3];
-   float r[3];
-   r[0] = x / xw;
-   r[1] = y / yw;
-   r[2] = z / zw;
-   for (int i = 0; i < 3; i++) {
-      if (r[i] > epsilon) {
-         f[i] = powf(r[i], 1.0f / 3.0f);
-      } else {
-         f[i] = (kappa * r[i] + 16.0f) / 116.0f;
+   float cpd[MAX_PYR_LEVELS];
+   float F_freq[MAX_PYR_LEVELS - 2];
+   unsigned int adaptation_level;
+   const GammaTable *gamma_table;
+   // Tiles keep their pyramids and chroma in half precision
+   bool half;
+   // The test for the options of the comparison
+   TileTest test;
+};
+
+// Working memory of one thread, reused from one tile to the next
+struct TileBuffers
+{
+   LPyramid la;
+   LPyramid lb;
+   AlignedFloats aA, aB, bA, bB;
+   // The chroma in half precision, the float planes then only holding one row
+   AlignedHalves haA, haB, hbA, hbB;
+};
+
+// Converts n pixels of row y of img starting at x. 8-bit components go
+// through the gamma table, RGBAFloat rows are used in place and other
+// formats are expanded to float a few pixels at a time.
+static void Convert_Pixels(const CompareArgs &args, const MetricConstants &mc,
+   const RGBAFloatImage *img, int x, int y, int n, float *lum, float *A, float *B)
+{
+   if (img->Get_Type() == PIXEL_UINT8) {
+      const int channels = img->Get_Channels();
+      Convert_Span_8Bit(img->Get_Raw_Row(y) + x * channels, n, channels, img->Get_Offsets(),
+         *mc.gamma_table, args.Luminance, args.ExactMath, lum, A, B);
+   } else if (const RGBAFloat *row = img->Get_Row(y)) {
+      Convert_Span(row + x, n, args.Gamma, args.Luminance, args.ExactMath, lum, A, B);
+   } else {
+      RGBAFloat span[64];
+      for (int i = 0; i < n; i += 64) {
+         const int m = n - i < 64 ? n - i : 64;
+         img->Get_Span(x + i, y, m, span);
+         Convert_Span(span, m, args.Gamma, args.Luminance, args.ExactMath,
+            lum ? lum + i : 0, A ? A + i : 0, B ? B + i : 0);
       }
    }
-   L = 116.0f * f[1] - 16.0f;
-   A = 500.0f * (f[0] - f[1]);
-   B = 200.0f * (f[1] - f[2]);
 }
 
-bool Yee_Compare(CompareArgs &args)
+// Converts the window [wx0, wx1) x [wy0, wy1) of img to luminance, stored
+// with the given row stride when lum is set. Pixels inside the core
+// [x0, x1) x [y0, y1) are also converted to LAB chroma when A and B are set,
+// stored with a row stride of x1 - x0. When hA and hB are set the chroma is
+// stored there in half precision instead, A and B only holding one row.
+static void Convert_Window(const CompareArgs &args, const MetricConstants &mc,
+   const RGBAFloatImage *img, int wx0, int wy0, int wx1, int wy1, float *lum, int stride,
+   float *A, float *B, int x0, int y0, int x1, int y1, uint16_t *hA = 0, uint16_t *hB = 0)
 {
-   if ((args.ImgA->Get_Width() != args.ImgB->Get_Width()) ||
-      (args.ImgA->Get_Height() != args.ImgB->Get_Height())) {
-      args.ErrorStr = "Image dimensions do not match\n";
-      return false;
-   }
+   const int cw = x1 - x0;
 
-   unsigned int i, dim;
-   dim = args.ImgA->Get_Width() * args.ImgA->Get_Height();
-   bool identical = true;
-   for (i = 0; i < dim; i++) {
-      if (args.ImgA->Get(i) != args.ImgB->Get(i)) {
-        identical = false;
-        break;
+   // assuming colorspaces are in Adobe RGB (1998) convert to XYZ
+   for (int y = wy0; y < wy1; y++) {
+      float *l = lum ? lum + (y - wy0) * stride - wx0 : 0;
+      if (!A || y < y0 || y >= y1) {
+         if (lum) Convert_Pixels(args, mc, img, wx0, y, wx1 - wx0, l + wx0, 0, 0);
+         continue;
+      }
+      // The core part of the row also needs chroma, the halo either side only luminance
+      const int ci = (y - y0) * cw;
+      Convert_Pixels(args, mc, img, x0, y, cw, lum ? l + x0 : 0, hA ? A : A + ci,
+         hB ? B : B + ci);
+      if (hA) {
+         Floats_To_Halves(hA + ci, A, cw);
+         Floats_To_Halves(hB + ci, B, cw);
+      }
+      if (lum) {
+         Convert_Pixels(args, mc, img, wx0, y, x0 - wx0, l + wx0, 0, 0);
+         Convert_Pixels(args, mc, img, x1, y, wx1 - x1, l + x1, 0, 0);
       }
    }
-   if (identical) {
-      args.ErrorStr = "Unclamped images are binary identical\n";
-      return true;
-   }
+}
 
-   // assuming colorspaces are in Adobe RGB (1998) convert to XYZ
-   float *aX = new float[dim];
-   float *aY = new float[dim];
-   float *aZ = new float[dim];
-   float *bX = new float[dim];
-   float *bY = new float[dim];
-   float *bZ = new float[dim];
-   float *aLum = new float[dim];
-   float *bLum = new float[dim];
-
-   float *aA = new float[dim];
-   float *bA = new float[dim];
-   float *aB = new float[dim];
-   float *bB = new float[dim];
-
-   if (args.Verbose) printf("Converting RGB to XYZ\n");
-
-   unsigned int x, y, w, h;
-   w = args.ImgA->Get_Width();
-   h = args.ImgA->Get_Height();
-   for (y = 0; y < h; y++) {
-      for (x = 0; x < w; x++) {
-         float r, g, b, l;
-         i = x + y * w;
-
-         // TODO: It might make sense to use values which are clamped to a displayable range
-         // (0.0-1.0) is some scenarios, but for now we ignore the fact that pixels above 1.0
-         // do not perceptually differ from those with value 1.0 and do the copmutations
-         // as if they were distinguishable.
-
-         r = powf(args.ImgA->Get_Red(i)  , args.Gamma);
-         g = powf(args.ImgA->Get_Green(i), args.Gamma);
-         b = powf(args.ImgA->Get_Blue(i) , args.Gamma);
-         AdobeRGBToXYZ(r,g,b,aX[i],aY[i],aZ[i]);
-         XYZToLAB(aX[i], aY[i], aZ[i], l, aA[i], aB[i]);
-
-         r = powf(args.ImgB->Get_Red(i)  , args.Gamma);
-         g = powf(args.ImgB->Get_Green(i), args.Gamma);
-         b = powf(args.ImgB->Get_Blue(i) , args.Gamma);
-         AdobeRGBToXYZ(r,g,b,bX[i],bY[i],bZ[i]);
-         XYZToLAB(bX[i], bY[i], bZ[i], l, bA[i], bB[i]);
-
-         aLum[i] = aY[i] * args.Luminance;
-         bLum[i] = bY[i] * args.Luminance;
-      }
+// Bytes of the chroma buffers
+static size_t Chroma_Memory(const TileBuffers &buf)
+{
+   return (buf.aA.capacity() + buf.aB.capacity() + buf.bA.capacity() + buf.bB.capacity()) *
+      sizeof(float) + (buf.haA.capacity() + buf.haB.capacity() + buf.hbA.capacity() +
+      buf.hbB.capacity()) * sizeof(uint16_t);
+}
+
+CompareWorkspace::CompareWorkspace(int num_threads) :
+   Pool(num_threads),
+   PeakMemory(0)
+{
+   for (int i = 0; i < Pool.Get_Num_Threads(); i++) {
+      Buffers.push_back(std::unique_ptr<TileBuffers>(new TileBuffers));
    }
+}
 
-   if (args.Verbose) printf("Constructing Laplacian Pyramids\n");
+CompareWorkspace::~CompareWorkspace()
+{
+}
 
-   LPyramid *la = new LPyramid(aLum, w, h);
-   LPyramid *lb = new LPyramid(bLum, w, h);
+size_t CompareWorkspace::Get_Memory() const
+{
+   size_t bytes = DecimatedA.Get_Memory() + DecimatedB.Get_Memory();
+   for (size_t i = 0; i < Buffers.size(); i++) {
+      bytes += Buffers[i]->la.Get_Memory() + Buffers[i]->lb.Get_Memory() +
+         Chroma_Memory(*Buffers[i]);
+   }
+   return bytes;
+}
 
-   float num_one_degree_pixels = (float) (2 * tan( args.FieldOfView * 0.5 * M_PI / 180) * 180 / M_PI);
-   float pixels_per_degree = w / num_one_degree_pixels;
+void CompareWorkspace::Update_Peak_Memory()
+{
+   PeakMemory = std::max(PeakMemory, Get_Memory());
+}
 
-   if (args.Verbose) printf("Performing test\n");
+CompareWorkspace &Thread_Workspace(int num_threads)
+{
+   static thread_local std::unique_ptr<CompareWorkspace> workspace;
+   const int n = num_threads > 0 ? num_threads : ThreadPool::Hardware_Threads();
+   if (!workspace || workspace->Pool.Get_Num_Threads() != n) {
+      workspace.reset();
+      workspace.reset(new CompareWorkspace(n));
+   }
+   return *workspace;
+}
 
-   float num_pixels = 1;
-   unsigned int adaptation_level = 0;
-   for (i = 0; i < MAX_PYR_LEVELS; i++) {
-      adaptation_level = i;
-      if (num_pixels > num_one_degree_pixels) break;
-      num_pixels *= 2;
+// Sizes the chroma planes for a width x height core
+static void Resize_Chroma(TileBuffers &buf, int width, int height, bool half)
+{
+   const int size = width * height;
+   if (half) {
+      buf.haA.resize(size);
+      buf.haB.resize(size);
+      buf.hbA.resize(size);
+      buf.hbB.resize(size);
    }
+   const int floats = half ? width : size;
+   buf.aA.resize(floats);
+   buf.aB.resize(floats);
+   buf.bA.resize(floats);
+   buf.bB.resize(floats);
+}
 
-   float cpd[MAX_PYR_LEVELS];
-   cpd[0] = 0.5f * pixels_per_degree;
-   for (i = 1; i < MAX_PYR_LEVELS; i++) cpd[i] = 0.5f * cpd[i - 1];
-   float csf_max = csf(3.248f, 100.0f);
+// How the levels of the pyramids are stored
+enum PyramidStorage
+{
+   PYR_FLOAT,
+   PYR_HALF,        // half precision levels and chroma
+   PYR_DECIMATED
+};
 
-   float F_freq[MAX_PYR_LEVELS - 2];
-   for (i = 0; i < MAX_PYR_LEVELS - 2; i++) F_freq[i] = csf_max / csf( cpd[i], 100.0f);
+template <int Storage>
+static inline float Level_Value(const LPyramid *p, int x, int y, int i, int level)
+{
+   if (Storage == PYR_HALF) return p->Get_Half_Value(i, level);
+   if (Storage == PYR_DECIMATED) return p->Get_Decimated_Value(x, y, level);
+   return p->Get_Float_Value(i, level);
+}
+
+// Runs the per-pixel test over the core [x0, x1) x [y0, y1) and returns the
+// number of pixels that failed. Pixel (x, y) of the image is pixel
+// (x - ox, y - oy) of the pyramids, and the chroma planes in buf cover the core.
+// The options are template parameters, so that each combination compiles to
+// a loop without their tests and with the level loops unrolled: Colour for
+// the chroma test, Record for a diff image, mask or fail bits to fill in
+// and Select for a selection of the pixels to test.
+template <int Storage, bool Colour, bool Record, bool Select>
+static unsigned int Test_Tile(CompareArgs &args, const MetricConstants &mc,
+   const LPyramid *la, const LPyramid *lb, int ox, int oy, const TileBuffers &buf,
+   int x0, int y0, int x1, int y1)
+{
+   const int w = args.ImgA->Get_Width();
+   const int cw = x1 - x0;
+   const int wa = la->Get_Width();
+   const int wb = lb->Get_Width();
 
    unsigned int pixels_failed = 0;
-   for (y = 0; y < h; y++) {
-     for (x = 0; x < w; x++) {
-      int index = x + y * w;
+   for (int y = y0; y < y1; y++) {
+     for (int x = x0; x < x1; x++) {
+      if (Select && !(args.Selected[(x >> 3) + y * args.SelectedStride] & (0x80 >> (x & 7)))) {
+         continue;
+      }
+      unsigned int i;
+      int px = x - ox;
+      int py = y - oy;
+      int ci = (x - x0) + (y - y0) * cw;
+      float va[MAX_PYR_LEVELS], vb[MAX_PYR_LEVELS];
+      for (i = 0; i < MAX_PYR_LEVELS; i++) {
+         va[i] = Level_Value<Storage>(la, px, py, px + py * wa, i);
+         vb[i] = Level_Value<Storage>(lb, px, py, px + py * wb, i);
+      }
       float contrast[MAX_PYR_LEVELS - 2];
       float sum_contrast = 0;
       for (i = 0; i < MAX_PYR_LEVELS - 2; i++) {
-         float n1 = fabsf(la->Get_Value(x,y,i) - la->Get_Value(x,y,i + 1));
-         float n2 = fabsf(lb->Get_Value(x,y,i) - lb->Get_Value(x,y,i + 1));
+         float n1 = fabsf(va[i] - va[i + 1]);
+         float n2 = fabsf(vb[i] - vb[i + 1]);
          float numerator = (n1 > n2) ? n1 : n2;
-         float d1 = fabsf(la->Get_Value(x,y,i+2));
-         float d2 = fabsf(lb->Get_Value(x,y,i+2));
+         float d1 = fabsf(va[i + 2]);
+         float d2 = fabsf(vb[i + 2]);
          float denominator = (d1 > d2) ? d1 : d2;
          if (denominator < 1e-5f) denominator = 1e-5f;
          contrast[i] = numerator / denominator;
@@ -237,73 +320,497 @@ bool Yee_Compare(CompareArgs &args)
       }
       if (sum_contrast < 1e-5) sum_contrast = 1e-5f;
       float F_mask[MAX_PYR_LEVELS - 2];
-      float adapt = la->Get_Value(x,y,adaptation_level) + lb->Get_Value(x,y,adaptation_level);
+      float adapt = va[mc.adaptation_level] + vb[mc.adaptation_level];
       adapt *= 0.5f;
       if (adapt < 1e-5) adapt = 1e-5f;
       for (i = 0; i < MAX_PYR_LEVELS - 2; i++) {
-         F_mask[i] = mask(contrast[i] * csf(cpd[i], adapt));
+         F_mask[i] = mask(contrast[i] * csf(mc.cpd[i], adapt));
       }
       float factor = 0;
       for (i = 0; i < MAX_PYR_LEVELS - 2; i++) {
-         factor += contrast[i] * F_freq[i] * F_mask[i] / sum_contrast;
+         factor += contrast[i] * mc.F_freq[i] * F_mask[i] / sum_contrast;
       }
       if (factor < 1) factor = 1;
       if (factor > 10) factor = 10;
-      float delta = fabsf(la->Get_Value(x,y,0) - lb->Get_Value(x,y,0));
+      float delta = fabsf(va[0] - vb[0]);
       bool pass = true;
       // pure luminance test
       if (delta > factor * tvi(adapt)) {
          pass = false;
-      } else if (!args.LuminanceOnly) {
-         // CIE delta E test with modifications
-         float color_scale = args.ColorFactor;
-         // ramp down the color test in scotopic regions
-         if (adapt < 10.0f) {
-            // Don't do color test at all.
-            color_scale = 0.0;
+      } else if (Colour && !(adapt < 10.0f)) {
+         // CIE delta E test with modifications, not done at all in
+         // scotopic regions
+         float da, db;
+         if (Storage == PYR_HALF) {
+            da = Half_To_Float(buf.haA[ci]) - Half_To_Float(buf.hbA[ci]);
+            db = Half_To_Float(buf.haB[ci]) - Half_To_Float(buf.hbB[ci]);
+         } else {
+            da = buf.aA[ci] - buf.bA[ci];
+            db = buf.aB[ci] - buf.bB[ci];
          }
-         float da = aA[index] - bA[index];
-         float db = aB[index] - bB[index];
          da = da * da;
          db = db * db;
-         float delta_e = (da + db) * color_scale;
+         float delta_e = (da + db) * args.ColorFactor;
          if (delta_e > factor) {
             pass = false;
          }
       }
-      if (!pass) {
-         pixels_failed++;
-         if (args.ImgDiff) {
-            args.ImgDiff->Set(1.f, 0.f, 0.f, 1.f, index);
+      if (!pass) pixels_failed++;
+      if (Record) {
+         if (args.ImgDiff) args.ImgDiff->Set(pass ? 0.f : 1.f, 0.f, 0.f, 1.f, x + y * w);
+         if (args.Mask) args.Mask[x + y * args.MaskStride] = pass ? 0 : 255;
+         if (!pass && args.FailBits) {
+            args.FailBits[(x >> 3) + y * args.FailBitsStride] |= 0x80 >> (x & 7);
+         }
+      }
+     }
+   }
+   return pixels_failed;
+}
+
+template <int Storage>
+static TileTest Tile_Test(bool colour, bool record, bool select)
+{
+   static const TileTest tests[8] = {
+      Test_Tile<Storage, false, false, false>, Test_Tile<Storage, false, false, true>,
+      Test_Tile<Storage, false, true, false>, Test_Tile<Storage, false, true, true>,
+      Test_Tile<Storage, true, false, false>, Test_Tile<Storage, true, false, true>,
+      Test_Tile<Storage, true, true, false>, Test_Tile<Storage, true, true, true>
+   };
+   return tests[colour * 4 + record * 2 + select];
+}
+
+// The variant of the test for the options of args. A colour factor of 0 or
+// less never fails a pixel, so it needs no chroma test.
+static TileTest Tile_Test(const CompareArgs &args, PyramidStorage storage)
+{
+   const bool colour = !args.LuminanceOnly && args.ColorFactor > 0;
+   const bool record = args.ImgDiff || args.Mask || args.FailBits;
+   const bool select = args.Selected != NULL;
+   switch (storage) {
+   case PYR_HALF: return Tile_Test<PYR_HALF>(colour, record, select);
+   case PYR_DECIMATED: return Tile_Test<PYR_DECIMATED>(colour, record, select);
+   default: return Tile_Test<PYR_FLOAT>(colour, record, select);
+   }
+}
+
+// Converts the core rectangle [x0, x1) x [y0, y1) plus the pyramid's halo,
+// builds both windowed pyramids and runs the test over the core. The
+// reference's pyramid and chroma are taken from ref_in when it is set, and
+// stored into ref_out when that is set.
+static unsigned int Compare_Tile(CompareArgs &args, const MetricConstants &mc,
+   TileBuffers &buf, const RefCache *ref_in, RefCache *ref_out,
+   int x0, int y0, int x1, int y1)
+{
+   const int w = args.ImgA->Get_Width();
+   const int h = args.ImgA->Get_Height();
+   const int cw = x1 - x0;
+
+   // Window: the core plus the pyramid's halo, clipped to the image
+   const int wx0 = x0 - PYR_HALO > 0 ? x0 - PYR_HALO : 0;
+   const int wy0 = y0 - PYR_HALO > 0 ? y0 - PYR_HALO : 0;
+   const int wx1 = x1 + PYR_HALO < w ? x1 + PYR_HALO : w;
+   const int wy1 = y1 + PYR_HALO < h ? y1 + PYR_HALO : h;
+   const int ww = wx1 - wx0;
+   const bool half = mc.half;
+
+   const uint64_t window = (uint64_t) ww * (wy1 - wy0);
+   const size_t memory = buf.la.Get_Memory() + buf.lb.Get_Memory() + Chroma_Memory(buf);
+   Resize_Chroma(buf, cw, y1 - y0, half);
+   if (!ref_in) buf.la.Resize(ww, wy1 - wy0, false, half);
+   buf.lb.Resize(ww, wy1 - wy0, false, half);
+   {
+      StageTimer timer(args.Stats, STATS_CONVERT, ref_in ? window : 2 * window);
+      timer.Add_Bytes(buf.la.Get_Memory() + buf.lb.Get_Memory() + Chroma_Memory(buf) - memory);
+      if (ref_in) {
+         float *levels[MAX_PYR_LEVELS];
+         for (int l = 0; l < MAX_PYR_LEVELS; l++) {
+            levels[l] = ref_in->Get_Level(l) + wx0 + wy0 * w;
+         }
+         buf.la.Wrap(levels, w, wy1 - wy0);
+         for (int y = y0; y < y1; y++) {
+            memcpy(&buf.aA[(y - y0) * cw], ref_in->Get_A() + x0 + y * w, cw * sizeof(float));
+            memcpy(&buf.aB[(y - y0) * cw], ref_in->Get_B() + x0 + y * w, cw * sizeof(float));
          }
       } else {
-         if (args.ImgDiff) {
-            args.ImgDiff->Set(0.f, 0.f, 0.f, 1.f, index);
+         Convert_Window(args, mc, args.ImgA, wx0, wy0, wx1, wy1, buf.la.Get_Base(), ww,
+            &buf.aA[0], &buf.aB[0], x0, y0, x1, y1, half ? &buf.haA[0] : 0,
+            half ? &buf.haB[0] : 0);
+      }
+      Convert_Window(args, mc, args.ImgB, wx0, wy0, wx1, wy1, buf.lb.Get_Base(), ww,
+         &buf.bA[0], &buf.bB[0], x0, y0, x1, y1, half ? &buf.hbA[0] : 0,
+         half ? &buf.hbB[0] : 0);
+   }
+   {
+      StageTimer timer(args.Stats, STATS_PYRAMID,
+         (ref_in ? 1 : 2) * window * (MAX_PYR_LEVELS - 1));
+      if (!ref_in) buf.la.Build(x0 - wx0, y0 - wy0, x1 - wx0, y1 - wy0);
+      buf.lb.Build(x0 - wx0, y0 - wy0, x1 - wx0, y1 - wy0);
+   }
+
+   if (ref_out) {
+      for (int y = y0; y < y1; y++) {
+         const int wi = (x0 - wx0) + (y - wy0) * ww;
+         for (int l = 0; l < MAX_PYR_LEVELS; l++) {
+            memcpy(ref_out->Get_Level(l) + x0 + y * w, buf.la.Get_Level(l) + wi, cw * sizeof(float));
          }
+         memcpy(ref_out->Get_A() + x0 + y * w, &buf.aA[(y - y0) * cw], cw * sizeof(float));
+         memcpy(ref_out->Get_B() + x0 + y * w, &buf.aB[(y - y0) * cw], cw * sizeof(float));
       }
-     }
    }
+   StageTimer timer(args.Stats, STATS_METRIC, (uint64_t) cw * (y1 - y0));
+   return mc.test(args, mc, &buf.la, &buf.lb, wx0, wy0, buf, x0, y0, x1, y1);
+}
 
-   if (aX) delete[] aX;
-   if (aY) delete[] aY;
-   if (aZ) delete[] aZ;
-   if (bX) delete[] bX;
-   if (bY) delete[] bY;
-   if (bZ) delete[] bZ;
-   if (aLum) delete[] aLum;
-   if (bLum) delete[] bLum;
-   if (la) delete la;
-   if (lb) delete lb;
-   if (aA) delete[] aA;
-   if (bA) delete[] bA;
-   if (aB) delete[] aB;
-   if (bB) delete[] bB;
+// Bounds of tile t of an image split into tiles_x columns of tiles
+static void Tile_Rect(int t, int tiles_x, int w, int h, int &x0, int &y0, int &x1, int &y1)
+{
+   x0 = (t % tiles_x) * TILE_SIZE;
+   y0 = (t / tiles_x) * TILE_SIZE;
+   x1 = x0 + TILE_SIZE < w ? x0 + TILE_SIZE : w;
+   y1 = y0 + TILE_SIZE < h ? y0 + TILE_SIZE : h;
+}
+
+// Shrinks [x0, x1) x [y0, y1) to the bounds of its selected pixels;
+// false if it has none
+static bool Selected_Bounds(const CompareArgs &args, int &x0, int &y0, int &x1, int &y1)
+{
+   if (!args.Selected) return true;
+   // x0 is a whole byte into the rows and no bits are set past their end
+   int bx0 = x1, by0 = y1, bx1 = x0, by1 = y0;
+   for (int y = y0; y < y1; y++) {
+      const unsigned char *row = args.Selected + y * args.SelectedStride;
+      for (int b = x0 >> 3; b < (x1 + 7) >> 3; b++) {
+         if (!row[b]) continue;
+         int first = 0, last = 7;
+         while (!(row[b] & (0x80 >> first))) first++;
+         while (!(row[b] & (0x80 >> last))) last--;
+         bx0 = std::min(bx0, b * 8 + first);
+         bx1 = std::max(bx1, b * 8 + last + 1);
+         by0 = std::min(by0, y);
+         by1 = y + 1;
+      }
+   }
+   if (bx0 >= bx1) return false;
+   x0 = bx0;
+   y0 = by0;
+   x1 = bx1;
+   y1 = by1;
+   return true;
+}
+
+static bool Tile_Differs(const CompareArgs &args, int x0, int y0, int x1, int y1)
+{
+   const RGBAFloatImage *imgA = args.ImgA;
+   const RGBAFloatImage *imgB = args.ImgB;
+   const bool same_layout = imgA->Get_Type() == imgB->Get_Type() &&
+      imgA->Get_Channels() == imgB->Get_Channels() &&
+      memcmp(imgA->Get_Offsets(), imgB->Get_Offsets(), 4 * sizeof(int)) == 0;
+
+   // Integers of the same layout are equal when their bytes are; floats
+   // are compared as floats, so that 0 equals -0
+   if (same_layout && imgA->Get_Type() != PIXEL_FLOAT) {
+      const int size = imgA->Get_Type() == PIXEL_UINT8 ? 1 : 2;
+      const int pixel = size * imgA->Get_Channels();
+      for (int y = y0; y < y1; y++) {
+         if (memcmp(imgA->Get_Raw_Row(y) + x0 * pixel, imgB->Get_Raw_Row(y) + x0 * pixel,
+               (x1 - x0) * pixel) != 0) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   RGBAFloat a[64], b[64];
+   for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x += 64) {
+         const int n = x1 - x < 64 ? x1 - x : 64;
+         imgA->Get_Span(x, y, n, a);
+         imgB->Get_Span(x, y, n, b);
+         for (int i = 0; i < n; i++) {
+            if (a[i] != b[i]) return true;
+         }
+      }
+   }
+   return false;
+}
+
+// Tile k of the visiting order is tile k * stride mod num_tiles. A stride
+// near num_tiles / golden ratio and coprime with it visits every tile once
+// while consecutive tiles land far apart, so a broken region of the image
+// is reached early wherever it is.
+static int Interleave_Stride(int num_tiles)
+{
+   int stride = (int) (num_tiles * 0.618f);
+   if (stride < 1) stride = 1;
+   for (;;) {
+      int a = num_tiles, b = stride;
+      while (b) { int r = a % b; a = b; b = r; }
+      if (a == 1) return stride;
+      stride++;
+   }
+}
+
+// Indices of the tiles to test: the dirty ones, or all of them, in the
+// interleaved order given by stride
+static std::vector<int> Tile_Order(const std::vector<char> &dirty, int stride, bool all)
+{
+   const int num_tiles = (int) dirty.size();
+   std::vector<int> order;
+   for (int k = 0; k < num_tiles; k++) {
+      int t = (int) ((long long) k * stride % num_tiles);
+      if (all || dirty[t]) order.push_back(t);
+   }
+   return order;
+}
+
+bool Compare_Images(CompareArgs &args)
+{
+   CompareWorkspace &workspace = args.Workspace ? *args.Workspace :
+      Thread_Workspace(args.NumThreads);
+   ThreadPool &pool = workspace.Pool;
+
+   unsigned int i;
+   unsigned int w, h;
+   w = args.ImgA->Get_Width();
+   h = args.ImgA->Get_Height();
+   const int tiles_x = (w + TILE_SIZE - 1) / TILE_SIZE;
+   const int tiles_y = (h + TILE_SIZE - 1) / TILE_SIZE;
+   const int num_tiles = tiles_x * tiles_y;
+
+   // A pixel of the same colour in both images has no luminance or chroma
+   // difference and always passes, so only tiles where the images differ
+   // need the metric; the others are final after this exact pre-pass.
+   // With a selection only the bounds of its pixels in a tile, the core,
+   // are looked at and the other pixels pass untested.
+   std::vector<char> dirty(num_tiles);
+   std::vector<int> cores(4 * num_tiles);
+   pool.Parallel_For(0, num_tiles, [&](int t0, int t1) {
+      StageTimer timer(args.Stats, STATS_PREPASS);
+      for (int t = t0; t < t1; t++) {
+         int x0, y0, x1, y1;
+         Tile_Rect(t, tiles_x, w, h, x0, y0, x1, y1);
+         int *core = &cores[4 * t];
+         core[0] = x0;
+         core[1] = y0;
+         core[2] = x1;
+         core[3] = y1;
+         dirty[t] = Selected_Bounds(args, core[0], core[1], core[2], core[3]);
+         if (dirty[t]) {
+            timer.Add_Pixels((uint64_t) (core[2] - core[0]) * (core[3] - core[1]));
+            dirty[t] = Tile_Differs(args, core[0], core[1], core[2], core[3]);
+         }
+         const bool clear = !dirty[t] || args.Selected;
+         if (clear && args.ImgDiff) {
+            for (int y = y0; y < y1; y++) {
+               for (int x = x0; x < x1; x++) args.ImgDiff->Set(0.f, 0.f, 0.f, 1.f, x + y * w);
+            }
+         }
+         if (clear && args.Mask) {
+            for (int y = y0; y < y1; y++) memset(args.Mask + x0 + y * args.MaskStride, 0, x1 - x0);
+         }
+      }
+   });
+   int num_dirty = 0;
+   for (int t = 0; t < num_tiles; t++) num_dirty += dirty[t];
+   args.PixelsFailed = 0;
+   args.Identical = num_dirty == 0;
+   args.Stopped = false;
+   args.WorkspacePeakBytes = workspace.Get_Peak_Memory();
+   if (args.Identical) return true;
+
+   float num_one_degree_pixels = (float) (2 * tan( args.FieldOfView * 0.5 * M_PI / 180) * 180 / M_PI);
+   float pixels_per_degree = w / num_one_degree_pixels;
+
+   GammaTable gamma_table(args.Gamma);
+   MetricConstants mc;
+   mc.gamma_table = &gamma_table;
+   float num_pixels = 1;
+   mc.adaptation_level = 0;
+   for (i = 0; i < MAX_PYR_LEVELS; i++) {
+      mc.adaptation_level = i;
+      if (num_pixels > num_one_degree_pixels) break;
+      num_pixels *= 2;
+   }
+
+   mc.cpd[0] = 0.5f * pixels_per_degree;
+   for (i = 1; i < MAX_PYR_LEVELS; i++) mc.cpd[i] = 0.5f * mc.cpd[i - 1];
+   float csf_max = csf(3.248f, 100.0f);
+
+   for (i = 0; i < MAX_PYR_LEVELS - 2; i++) mc.F_freq[i] = csf_max / csf( mc.cpd[i], 100.0f);
+
+   std::atomic<unsigned int> pixels_failed(0);
+
+   // Without a diff image or mask to fill in, fail fast stops testing tiles
+   // once the threshold is reached; the count is then a lower bound
+   const bool fail_fast = args.FailFast && !args.ImgDiff && !args.Mask && !args.FailBits;
+   const int stride = fail_fast ? Interleave_Stride(num_tiles) : 1;
+   std::atomic<bool> stop(false);
+   // Tiles tested and tiles to test; the count is only a lower bound when
+   // some were skipped, not when the threshold is reached on the last one
+   std::atomic<int> visited(0);
+   int num_visits = 0;
+
+   if (args.DecimatedPyramid) {
+      // A decimated pyramid is built over the whole image first, its
+      // levels only take a third more memory than the luminance itself
+      if (args.Verbose) printf("Constructing decimated Laplacian Pyramids\n");
+      mc.half = false;
+      mc.test = Tile_Test(args, PYR_DECIMATED);
+      LPyramid own_a, own_b;
+      LPyramid &la = args.Workspace ? args.Workspace->DecimatedA : own_a;
+      LPyramid &lb = args.Workspace ? args.Workspace->DecimatedB : own_b;
+      const size_t memory = la.Get_Memory() + lb.Get_Memory();
+      la.Resize(w, h, true);
+      lb.Resize(w, h, true);
+      pool.Parallel_For(0, num_tiles, [&](int t0, int t1) {
+         StageTimer timer(args.Stats, STATS_CONVERT);
+         for (int t = t0; t < t1; t++) {
+            int x0, y0, x1, y1;
+            Tile_Rect(t, tiles_x, w, h, x0, y0, x1, y1);
+            timer.Add_Pixels(2 * (uint64_t) (x1 - x0) * (y1 - y0));
+            Convert_Window(args, mc, args.ImgA, x0, y0, x1, y1, la.Get_Base() + x0 + y0 * w, w,
+               NULL, NULL, x0, y0, x1, y1);
+            Convert_Window(args, mc, args.ImgB, x0, y0, x1, y1, lb.Get_Base() + x0 + y0 * w, w,
+               NULL, NULL, x0, y0, x1, y1);
+         }
+      });
+      {
+         StageTimer timer(args.Stats, STATS_PYRAMID, 2 * (uint64_t) w * h);
+         timer.Add_Bytes(la.Get_Memory() + lb.Get_Memory() - memory);
+         pool.Parallel_For(0, 2, [&](int p0, int p1) {
+            for (int p = p0; p < p1; p++) {
+               (p == 0 ? la : lb).Build_Decimated(&pool);
+            }
+         });
+      }
+
+      const std::vector<int> order = Tile_Order(dirty, stride, false);
+      num_visits = (int) order.size();
+      if (args.Verbose) printf("Performing test on %d of %d tiles\n", (int) order.size(), num_tiles);
+      pool.Parallel_For(0, (int) order.size(), [&](int k0, int k1) {
+         TileBuffers &buf = workspace.Get_Buffers();
+         for (int k = k0; k < k1 && !stop; k++) {
+            const int *core = &cores[4 * order[k]];
+            const int x0 = core[0], y0 = core[1], x1 = core[2], y1 = core[3];
+            const uint64_t area = (uint64_t) (x1 - x0) * (y1 - y0);
+            unsigned int failed;
+            {
+               const size_t memory = Chroma_Memory(buf);
+               StageTimer timer(args.Stats, STATS_CONVERT, 2 * area);
+               Resize_Chroma(buf, x1 - x0, y1 - y0, false);
+               timer.Add_Bytes(Chroma_Memory(buf) - memory);
+               Convert_Window(args, mc, args.ImgA, x0, y0, x1, y1, NULL, 0,
+                  &buf.aA[0], &buf.aB[0], x0, y0, x1, y1);
+               Convert_Window(args, mc, args.ImgB, x0, y0, x1, y1, NULL, 0,
+                  &buf.bA[0], &buf.bB[0], x0, y0, x1, y1);
+            }
+            {
+               StageTimer timer(args.Stats, STATS_METRIC, area);
+               failed = mc.test(args, mc, &la, &lb, 0, 0, buf, x0, y0, x1, y1);
+            }
+            visited++;
+            if ((pixels_failed += failed) >= args.ThresholdPixels && fail_fast) stop = true;
+         }
+      });
+   } else {
+      // The reference's derived data is taken from memory or its cache file
+      // when that is up to date, otherwise it is kept while comparing and
+      // stored
+      std::shared_ptr<const RefCache> ref_in;
+      std::shared_ptr<RefCache> ref_out;
+      if (args.RefSlot) {
+         ref_in = args.RefSlot->Get(args);
+         if (!ref_in) ref_out.reset(RefCache::Create(args));
+      } else if (!args.RefCacheFile.empty()) {
+         ref_in.reset(RefCache::Open(args.RefCacheFile.c_str(), args));
+         if (!ref_in) ref_out.reset(RefCache::Create(args));
+         if (args.Verbose) {
+            printf("%s reference cache %s\n", ref_in ? "Using" : "Writing",
+               args.RefCacheFile.c_str());
+         }
+      }
+      // The reference cache holds float data, so -halfprecision is not used with it
+      mc.half = args.HalfPrecision && !ref_in && !ref_out;
+      mc.test = Tile_Test(args, mc.half ? PYR_HALF : PYR_FLOAT);
+
+      // Colour conversion, pyramid construction and the per-pixel test are
+      // fused per tile, so only one tile's working set per thread is alive.
+      // A cache being written needs the clean tiles as well, and whole.
+      const std::vector<int> order = Tile_Order(dirty, stride, ref_out != NULL);
+      num_visits = (int) order.size();
+      if (args.Verbose) printf("Performing test on %d of %d tiles\n", (int) order.size(), num_tiles);
+      pool.Parallel_For(0, (int) order.size(), [&](int k0, int k1) {
+         TileBuffers &buf = workspace.Get_Buffers();
+         for (int k = k0; k < k1 && !stop; k++) {
+            int x0, y0, x1, y1;
+            Tile_Rect(order[k], tiles_x, w, h, x0, y0, x1, y1);
+            if (!ref_out) {
+               const int *core = &cores[4 * order[k]];
+               x0 = core[0];
+               y0 = core[1];
+               x1 = core[2];
+               y1 = core[3];
+            }
+            unsigned int failed = Compare_Tile(args, mc, buf, ref_in.get(), ref_out.get(),
+               x0, y0, x1, y1);
+            visited++;
+            if ((pixels_failed += failed) >= args.ThresholdPixels && fail_fast) stop = true;
+         }
+      });
+
+      // A cache is only complete if every tile was visited
+      const bool complete = visited == num_visits;
+      if (ref_out && complete && args.RefSlot) {
+         args.RefSlot->Put(ref_out);
+      } else if (ref_out && complete && !ref_out->Save(args.RefCacheFile.c_str())) {
+         fprintf(stderr, "Could not write reference cache %s\n", args.RefCacheFile.c_str());
+      }
+   }
+
+   args.PixelsFailed = pixels_failed;
+   args.Stopped = visited < num_visits;
+   workspace.Update_Peak_Memory();
+   args.WorkspacePeakBytes = workspace.Get_Peak_Memory();
+   return args.PixelsFailed < args.ThresholdPixels;
+}
+
+// Describes the outcome of Compare_Images in args.ErrorStr and writes the
+// difference image
+static void Report_Result(CompareArgs &args, bool passed)
+{
+   if (args.FailBits) {
+      const std::string *files[3] = {
+         &args.FailMaskFile, &args.FailSpansFile, &args.FailBoxesFile
+      };
+      bool (*const writers[3])(const char *, const unsigned char *, ptrdiff_t, int, int) = {
+         Write_Fail_Mask, Write_Fail_Spans, Write_Fail_Boxes
+      };
+      const int w = args.ImgA->Get_Width();
+      const int h = args.ImgA->Get_Height();
+      StageTimer timer(args.Stats, STATS_WRITE, (uint64_t) w * h);
+      for (int i = 0; i < 3; i++) {
+         if (!files[i]->empty() &&
+               !writers[i](files[i]->c_str(), args.FailBits, args.FailBitsStride, w, h)) {
+            fprintf(stderr, "Could not write %s\n", files[i]->c_str());
+         }
+      }
+   }
 
+   if (args.Identical) {
+      args.ErrorStr = args.Selected ?
+         "Unclamped images are binary identical in the tested pixels\n" :
+         "Unclamped images are binary identical\n";
+      return;
+   }
    char different[100];
-   sprintf(different, "%d pixels are different\n", pixels_failed);
+   sprintf(different, "%s%u pixels are different\n", args.Stopped ? "at least " : "",
+      args.PixelsFailed);
 
    // Always output image difference if requested.
    if (args.ImgDiff) {
+      StageTimer timer(args.Stats, STATS_WRITE,
+         (uint64_t) args.ImgDiff->Get_Width() * args.ImgDiff->Get_Height());
       if (args.ImgDiff->WriteToFile(args.ImgDiff->Get_Name().c_str())) {
          args.ErrorStr += "Wrote difference image to ";
          args.ErrorStr += args.ImgDiff->Get_Name();
@@ -315,14 +822,47 @@ bool Yee_Compare(CompareArgs &args)
       }
    }
 
-   if (pixels_failed < args.ThresholdPixels) {
+   if (passed) {
       args.ErrorStr = "Images are perceptually indistinguishable\n";
       args.ErrorStr += different;
-      return true;
+      return;
    }
 
    args.ErrorStr = "Images are visibly different\n";
    args.ErrorStr += different;
+}
 
-   return false;
+bool Yee_Compare(CompareArgs &args)
+{
+   if (args.CacheHit) return args.CachedPass;
+   if ((args.ImgA->Get_Width() != args.ImgB->Get_Width()) ||
+      (args.ImgA->Get_Height() != args.ImgB->Get_Height())) {
+      args.ErrorStr = "Image dimensions do not match\n";
+      return false;
+   }
+
+   // Files that differ but decode to the same pixels as an earlier
+   // comparison are caught here, before any colour conversion
+   const bool cached = !args.CacheDir.empty() && !args.ImgDiff && !args.FailBits &&
+      !args.Selected;
+   ResultCache cache(args.CacheDir);
+   std::string pixel_key;
+   bool passed;
+   if (cached) {
+      pixel_key = ResultCache::Pixel_Key(args);
+      if (cache.Lookup(pixel_key, passed, args.PixelsFailed, args.ErrorStr)) {
+         if (args.Verbose) printf("Result found in cache %s\n", args.CacheDir.c_str());
+         if (!args.FileKey.empty()) cache.Store(args.FileKey, passed, args.PixelsFailed, args.ErrorStr);
+         return passed;
+      }
+   }
+
+   passed = Compare_Images(args);
+   Report_Result(args, passed);
+
+   if (cached) {
+      cache.Store(pixel_key, passed, args.PixelsFailed, args.ErrorStr);
+      if (!args.FileKey.empty()) cache.Store(args.FileKey, passed, args.PixelsFailed, args.ErrorStr);
+   }
+   return passed;
 }
@@ -17,11 +17,67 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 #ifndef _METRIC_H
 #define _METRIC_H
 
+#include "LPyramid.h"
+#include "ThreadPool.h"
+#include <memory>
+#include <vector>
+
 class CompareArgs;
 
+struct TileBuffers;
+
+// Threads and working memory kept from one comparison to the next, as in a
+// sequence of frames; see CompareArgs::Workspace. Each thread of the pool
+// has its tile buffers here, and the decimated pyramids are kept as well.
+// A workspace serves one comparison at a time.
+class CompareWorkspace
+{
+public:
+   // num_threads <= 0 means one thread per hardware core
+   CompareWorkspace(int num_threads);
+   ~CompareWorkspace();
+
+   // The tile buffers of the calling thread of the pool
+   TileBuffers &Get_Buffers() { return *Buffers[Pool.Thread_Index()]; }
+   // Bytes of the buffers held, and the most held at the end of a
+   // comparison so far
+   size_t Get_Memory() const;
+   size_t Get_Peak_Memory() const { return PeakMemory; }
+   void Update_Peak_Memory();
+
+   ThreadPool Pool;
+   LPyramid DecimatedA, DecimatedB;
+
+private:
+   CompareWorkspace(const CompareWorkspace&);
+   CompareWorkspace& operator=(const CompareWorkspace&);
+
+   std::vector<std::unique_ptr<TileBuffers> > Buffers;
+   size_t PeakMemory;
+};
+
+// The workspace of comparisons given none, one per calling thread and kept
+// while the thread count stays the same. A thread that runs many, as in a
+// batch, the server or a library caller, starts its threads and allocates
+// its buffers only once. num_threads <= 0 means one per hardware core.
+CompareWorkspace &Thread_Workspace(int num_threads);
+
 // Image comparison metric using Yee's method
 // References: A Perceptual Metric for Production Testing, Hector Yee, Journal of Graphics Tools 2004
+// Also consults the result cache and describes the outcome in args.ErrorStr.
 bool Yee_Compare(CompareArgs &args);
 
+// The metric itself, on two images of the same size. Returns whether they
+// pass and sets args.PixelsFailed, Identical and Stopped; fills in
+// args.ImgDiff and args.Mask when they are set. Uses no global state, so
+// any number of threads may compare at once.
+bool Compare_Images(CompareArgs &args);
+
+// The per-pixel model: threshold vs intensity (Ward Larson 1997), contrast
+// sensitivity (Barten 1989) and visual masking (Daly 1993)
+float tvi(float adaptation_luminance);
+float csf(float cpd, float lum);
+float mask(float contrast);
+
 #endif
 
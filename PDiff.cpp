@@ -0,0 +1,123 @@
+/*
+PDiff
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "PDiff.h"
+#include "CompareArgs.h"
+#include "Metric.h"
+#include "RGBAImage.h"
+#include <memory>
+#include <new>
+
+PDiffParams::PDiffParams() :
+   FieldOfView(45.0f),
+   Gamma(2.2f),
+   Luminance(100.0f),
+   ColorFactor(1.0f),
+   LuminanceOnly(false),
+   ThresholdPixels(100),
+   NumThreads(0),
+   DecimatedPyramid(false),
+   ExactMath(false),
+   HalfPrecision(false),
+   FailFast(false)
+{
+}
+
+// Wraps the caller's pixels in an image that reads them in place
+static RGBAFloatImage *Make_View(const PDiffImage &img, const char *name)
+{
+   static const int rgba[4] = { 0, 1, 2, 3 };
+   static const int bgra[4] = { 2, 1, 0, 3 };
+   PixelType type;
+   int channels;
+   const int *order = rgba;
+   switch (img.Format) {
+   case PDIFF_RGB8:       type = PIXEL_UINT8;  channels = 3; break;
+   case PDIFF_RGBA8:      type = PIXEL_UINT8;  channels = 4; break;
+   case PDIFF_BGR8:       type = PIXEL_UINT8;  channels = 3; order = bgra; break;
+   case PDIFF_BGRA8:      type = PIXEL_UINT8;  channels = 4; order = bgra; break;
+   case PDIFF_RGB16:      type = PIXEL_UINT16; channels = 3; break;
+   case PDIFF_RGBA16:     type = PIXEL_UINT16; channels = 4; break;
+   case PDIFF_RGB_FLOAT:  type = PIXEL_FLOAT;  channels = 3; break;
+   case PDIFF_RGBA_FLOAT: type = PIXEL_FLOAT;  channels = 4; break;
+   default: return NULL;
+   }
+   if (!img.Pixels || img.Width <= 0 || img.Height <= 0) return NULL;
+
+   int offset[4] = { order[0], order[1], order[2], channels == 4 ? order[3] : -1 };
+   const int size = type == PIXEL_UINT8 ? 1 : type == PIXEL_UINT16 ? 2 : 4;
+   const ptrdiff_t stride = img.Stride ? img.Stride : (ptrdiff_t) img.Width * channels * size;
+   return new RGBAFloatImage(img.Width, img.Height, name, type, channels, offset,
+      img.Pixels, stride, std::shared_ptr<void>());
+}
+
+struct PDiffWorkspace
+{
+   PDiffWorkspace(int num_threads) : Workspace(num_threads) {}
+
+   CompareWorkspace Workspace;
+};
+
+PDiffWorkspace *PDiff_Create_Workspace(int num_threads)
+{
+   return new PDiffWorkspace(num_threads);
+}
+
+void PDiff_Destroy_Workspace(PDiffWorkspace *workspace)
+{
+   delete workspace;
+}
+
+size_t PDiff_Workspace_Peak_Bytes(const PDiffWorkspace *workspace)
+{
+   return workspace->Workspace.Get_Peak_Memory();
+}
+
+PDiffStatus PDiff_Compare(const PDiffImage &a, const PDiffImage &b, const PDiffParams &params,
+   PDiffResult &result, unsigned char *mask, ptrdiff_t mask_stride, PDiffWorkspace *workspace)
+{
+   // The arguments own the two views and are local to this call
+   CompareArgs args;
+   args.ImgA = Make_View(a, "A");
+   args.ImgB = Make_View(b, "B");
+   if (!args.ImgA || !args.ImgB) return PDIFF_INVALID_IMAGE;
+   if (a.Width != b.Width || a.Height != b.Height) return PDIFF_SIZE_MISMATCH;
+
+   args.FieldOfView = params.FieldOfView;
+   args.Gamma = params.Gamma;
+   args.Luminance = params.Luminance;
+   args.ColorFactor = params.ColorFactor;
+   args.LuminanceOnly = params.LuminanceOnly;
+   args.ThresholdPixels = params.ThresholdPixels;
+   args.NumThreads = params.NumThreads;
+   args.DecimatedPyramid = params.DecimatedPyramid;
+   args.ExactMath = params.ExactMath;
+   args.HalfPrecision = params.HalfPrecision;
+   args.FailFast = params.FailFast;
+   args.Mask = mask;
+   args.MaskStride = mask_stride ? mask_stride : a.Width;
+   if (workspace) args.Workspace = &workspace->Workspace;
+
+   try {
+      result.Passed = Compare_Images(args);
+   } catch (const std::bad_alloc&) {
+      return PDIFF_OUT_OF_MEMORY;
+   }
+   result.PixelsFailed = args.PixelsFailed;
+   result.Identical = args.Identical;
+   result.Stopped = args.Stopped;
+   return PDIFF_OK;
+}
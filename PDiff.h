@@ -0,0 +1,109 @@
+/*
+PDiff
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _PDIFF_H
+#define _PDIFF_H
+
+// Interface of libperceptualdiff for comparing images held in memory. The
+// images are read in place and no global state is used, so any number of
+// threads may call PDiff_Compare at once. The threads and working memory of
+// a comparison are kept for the next one, in a PDiffWorkspace when the call
+// is given one and otherwise by the calling thread.
+
+#include <cstddef>
+
+// Layout of the pixels of a caller's buffer. 8 and 16 bit components map
+// 0..255 and 0..65535 to 0..1; float components are used as they are.
+enum PDiffFormat
+{
+   PDIFF_RGB8,
+   PDIFF_RGBA8,
+   PDIFF_BGR8,
+   PDIFF_BGRA8,
+   PDIFF_RGB16,
+   PDIFF_RGBA16,
+   PDIFF_RGB_FLOAT,
+   PDIFF_RGBA_FLOAT
+};
+
+// An image owned by the caller. Row y starts at Pixels + y * Stride bytes;
+// a Stride of 0 means rows packed one after another, and a negative one
+// bottom-up storage. 16 bit and float components must be aligned.
+struct PDiffImage
+{
+   const void *Pixels;
+   int Width;
+   int Height;
+   ptrdiff_t Stride;
+   PDiffFormat Format;
+};
+
+// Parameters of the comparison, the command line options of the same names
+struct PDiffParams
+{
+   PDiffParams();
+
+   float FieldOfView;              // Field of view in degrees
+   float Gamma;                    // The gamma to convert to linear color space
+   float Luminance;                // The display's luminance
+   float ColorFactor;              // How much color to use, 0.0 to 1.0
+   bool LuminanceOnly;             // Ignore chroma
+   unsigned int ThresholdPixels;   // How many pixels different to ignore
+   int NumThreads;                 // 0 means one per hardware core
+   bool DecimatedPyramid;          // Use a decimated Laplacian pyramid
+   bool ExactMath;                 // Use libm's powf for the colour conversion
+   bool HalfPrecision;             // Store pyramids and chroma as 16-bit floats,
+                                   // unless DecimatedPyramid is set
+   bool FailFast;                  // Stop once ThresholdPixels pixels failed
+};
+
+struct PDiffResult
+{
+   bool Passed;                    // Fewer than ThresholdPixels pixels failed
+   unsigned int PixelsFailed;      // A lower bound when Stopped is set
+   bool Identical;                 // Same pixel values, the metric did not run
+   bool Stopped;                   // FailFast stopped testing early
+};
+
+enum PDiffStatus
+{
+   PDIFF_OK,
+   PDIFF_INVALID_IMAGE,            // NULL pixels, empty size or unknown format
+   PDIFF_SIZE_MISMATCH,
+   PDIFF_OUT_OF_MEMORY             // The working buffers could not be allocated
+};
+
+// Threads and per-thread buffers reused by the comparisons given it. It
+// serves one comparison at a time; threads comparing at once each need
+// their own.
+struct PDiffWorkspace;
+
+// num_threads <= 0 means one per hardware core
+PDiffWorkspace *PDiff_Create_Workspace(int num_threads);
+void PDiff_Destroy_Workspace(PDiffWorkspace *workspace);
+// The most bytes the workspace's buffers have held at the end of a comparison
+size_t PDiff_Workspace_Peak_Bytes(const PDiffWorkspace *workspace);
+
+// Compares a and b, which must have the same size. When mask is given it
+// receives one byte per pixel, 255 where the pixel failed and 0 elsewhere,
+// pixel (x, y) being mask[x + y * mask_stride]; a mask_stride of 0 means
+// the width. FailFast is ignored when there is a mask to fill in. With a
+// workspace, its threads are used and params.NumThreads is ignored.
+PDiffStatus PDiff_Compare(const PDiffImage &a, const PDiffImage &b, const PDiffParams &params,
+   PDiffResult &result, unsigned char *mask = 0, ptrdiff_t mask_stride = 0,
+   PDiffWorkspace *workspace = 0);
+
+#endif
@@ -17,6 +17,7 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <string>
@@ -24,12 +25,27 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 #include "RGBAImage.h"
 #include "CompareArgs.h"
 #include "Metric.h"
+#include "Batch.h"
+#include "Sequence.h"
+#include "Server.h"
+#include "Stats.h"
 
 int main(int argc, char **argv)
 {
+   for (int i = 1; i + 1 < argc; i++) {
+      if (strcmp(argv[i], "-batch") == 0) return Run_Batch(argv[i + 1], argc, argv);
+      if (strcmp(argv[i], "-serve") == 0) return Run_Server(argv[i + 1], argc, argv);
+      if (strcmp(argv[i], "-client") == 0) return Run_Client(argv[i + 1], argc, argv);
+      if (strcmp(argv[i], "-sequence") == 0 && i + 2 < argc) {
+         return Run_Sequence(atoi(argv[i + 1]), atoi(argv[i + 2]), argc, argv);
+      }
+   }
+
    CompareArgs args;
 
-   if (!args.Parse_Args(argc, argv)) {
+   const bool parsed = args.Parse_Args(argc, argv);
+   fprintf(stderr, "%s", args.Warnings.c_str());
+   if (!parsed || !args.Load_Images()) {
       printf("%s", args.ErrorStr.c_str());
       return -1;
    } else {
@@ -43,6 +59,9 @@ int main(int argc, char **argv)
    } else {
       printf("FAIL: %s\n", args.ErrorStr.c_str());
    }
+   if (args.Stats && !args.Stats->Write_JSON(args.StatsFile.c_str(), args, passed)) {
+      fprintf(stderr, "Could not write stats to %s\n", args.StatsFile.c_str());
+   }
 
    return passed ? 0 : 1;
 }
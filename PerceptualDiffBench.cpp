@@ -0,0 +1,317 @@
+/*
+PerceptualDiffBench
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+// Benchmarks of the comparison's hot paths on synthetic images. Every
+// measurement prints one tab separated line
+//
+//    benchmark width height density iterations ms_per_iteration mpixels_per_second
+//
+// after a header line of those names. The density is the fraction of
+// pixels changed in the second image, or - where the content does not matter.
+
+#include "CompareArgs.h"
+#include "ColorSpace.h"
+#include "LPyramid.h"
+#include "Metric.h"
+#include "RGBAImage.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <math.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+static const char *usage =
+"perceptualdiff_bench [options]\n\
+\t-sizes a,b,...     : Square image sizes (default 256,1024,2048,4096,8192)\n\
+\t-densities a,b,... : Fractions of differing pixels (default 0,0.001,0.01,0.1,1)\n\
+\t-mintime s         : Seconds to repeat each benchmark for (default 0.5)\n\
+\t-threads n         : Threads of the full comparisons (default: one per core)\n\
+\t-filter name       : Only run the benchmarks whose name contains name\n\
+\t-tmp dir           : Directory for the files read back (default /tmp)\n";
+
+struct BenchOptions
+{
+   std::vector<int> Sizes;
+   std::vector<float> Densities;
+   double MinTime;
+   int NumThreads;
+   std::string Filter;
+   std::string TmpDir;
+};
+
+// Gives access to the protected convolution
+class BenchPyramid : public LPyramid
+{
+public:
+   void Blur() { Convolve(Levels[1], Levels[0], 0, 0, Width, Height); }
+};
+
+// Reproducible pseudo random numbers in [0, 2^24)
+static uint32_t Next_Random(uint32_t &state)
+{
+   state = state * 1664525u + 1013904223u;
+   return state >> 8;
+}
+
+// Runs func repeatedly for at least the minimum time and prints its line
+static void Run(const BenchOptions &opts, const char *name, int w, int h, float density,
+   const std::function<void()> &func)
+{
+   if (!opts.Filter.empty() && !strstr(name, opts.Filter.c_str())) return;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   int iterations = 0;
+   double elapsed;
+   do {
+      func();
+      iterations++;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < opts.MinTime);
+
+   char dens[32] = "-";
+   if (density >= 0) sprintf(dens, "%g", density);
+   const double ms = elapsed * 1000 / iterations;
+   printf("%s\t%d\t%d\t%s\t%d\t%.3f\t%.2f\n", name, w, h, dens, iterations, ms,
+      (double) w * h / (ms * 1000));
+   fflush(stdout);
+}
+
+// 8-bit RGBA pixels of smooth gradients with some noise
+static std::shared_ptr<unsigned char> Make_Pixels(int w, int h)
+{
+   std::shared_ptr<unsigned char> pixels(new unsigned char[(size_t) w * h * 4],
+      std::default_delete<unsigned char[]>());
+   uint32_t state = 1;
+   unsigned char *p = pixels.get();
+   for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++, p += 4) {
+         const int noise = Next_Random(state) % 16;
+         p[0] = (unsigned char) (x * 239 / w + noise);
+         p[1] = (unsigned char) (y * 239 / h + noise);
+         p[2] = (unsigned char) ((x + y) * 119 / (w + h) + 64 + noise);
+         p[3] = 255;
+      }
+   }
+   return pixels;
+}
+
+// A copy of a with the given fraction of pixels visibly changed
+static std::shared_ptr<unsigned char> Change_Pixels(const std::shared_ptr<unsigned char> &a,
+   int w, int h, float density)
+{
+   const size_t size = (size_t) w * h * 4;
+   std::shared_ptr<unsigned char> b(new unsigned char[size], std::default_delete<unsigned char[]>());
+   memcpy(b.get(), a.get(), size);
+   const uint32_t limit = (uint32_t) (density * (1 << 24));
+   uint32_t state = 2;
+   for (size_t i = 0; i < size; i += 4) {
+      if (Next_Random(state) >= limit && density < 1) continue;
+      for (int c = 0; c < 3; c++) b.get()[i + c] ^= 0x40;
+   }
+   return b;
+}
+
+static RGBAFloatImage *Make_Image(int w, int h, const char *name,
+   const std::shared_ptr<unsigned char> &pixels)
+{
+   static const int offset[4] = { 0, 1, 2, 3 };
+   return new RGBAFloatImage(w, h, name, PIXEL_UINT8, 4, offset, pixels.get(), w * 4, pixels);
+}
+
+// Writes the pixels as a binary PPM, the format read in place
+static bool Write_PPM(const std::string &path, const unsigned char *pixels, int w, int h)
+{
+   FILE *f = fopen(path.c_str(), "wb");
+   if (!f) return false;
+   fprintf(f, "P6\n%d %d\n255\n", w, h);
+   std::vector<unsigned char> row(w * 3);
+   bool ok = true;
+   for (int y = 0; y < h && ok; y++) {
+      for (int x = 0; x < w; x++) memcpy(&row[x * 3], pixels + ((size_t) y * w + x) * 4, 3);
+      ok = fwrite(&row[0], 1, row.size(), f) == row.size();
+   }
+   return (fclose(f) == 0) && ok;
+}
+
+// Writes the pixels as a PNG, which is decoded by FreeImage
+static bool Write_PNG(const std::string &path, const unsigned char *pixels, int w, int h)
+{
+   FIBITMAP *bitmap = FreeImage_Allocate(w, h, 32);
+   if (!bitmap) return false;
+   for (int y = 0; y < h; y++) {
+      unsigned char *line = FreeImage_GetScanLine(bitmap, h - 1 - y);
+      const unsigned char *p = pixels + (size_t) y * w * 4;
+      for (int x = 0; x < w; x++, p += 4, line += 4) {
+         line[FI_RGBA_RED] = p[0];
+         line[FI_RGBA_GREEN] = p[1];
+         line[FI_RGBA_BLUE] = p[2];
+         line[FI_RGBA_ALPHA] = p[3];
+      }
+   }
+   const bool ok = !!FreeImage_Save(FIF_PNG, bitmap, path.c_str());
+   FreeImage_Unload(bitmap);
+   return ok;
+}
+
+static void Bench_Size(const BenchOptions &opts, int size)
+{
+   const int w = size, h = size;
+   std::shared_ptr<unsigned char> pixels = Make_Pixels(w, h);
+   std::unique_ptr<RGBAFloatImage> img(Make_Image(w, h, "A", pixels));
+
+   // The kernels run over strips of rows, as the comparison runs over
+   // tiles, so the largest sizes fit in memory
+   const int strip = h < 256 ? h : 256;
+   {
+      BenchPyramid pyr;
+      pyr.Resize(w, strip);
+      float *base = pyr.Get_Base();
+      for (int i = 0; i < w * strip; i++) base[i] = (float) pixels.get()[i * 4 + 1];
+      Run(opts, "convolve", w, h, -1, [&]() {
+         for (int y = 0; y < h; y += strip) pyr.Blur();
+      });
+   }
+
+   std::vector<float> lum(w), A(w), B(w);
+   GammaTable table(2.2f);
+   static const int rgb[3] = { 0, 1, 2 };
+   for (int exact = 0; exact < 2; exact++) {
+      Run(opts, exact ? "convert_8bit_exact" : "convert_8bit", w, h, -1, [&]() {
+         for (int y = 0; y < h; y++) {
+            Convert_Span_8Bit(img->Get_Raw_Row(y), w, 4, rgb, table, 100.0f, exact != 0,
+               &lum[0], &A[0], &B[0]);
+         }
+      });
+   }
+   std::vector<RGBAFloat> row(w);
+   img->Get_Span(0, 0, w, &row[0]);
+   for (int exact = 0; exact < 2; exact++) {
+      Run(opts, exact ? "convert_float_exact" : "convert_float", w, h, -1, [&]() {
+         for (int y = 0; y < h; y++) {
+            Convert_Span(&row[0], w, 2.2f, 100.0f, exact != 0, &lum[0], &A[0], &B[0]);
+         }
+      });
+   }
+
+   // Adaptation luminances and contrasts spanning the models' ranges
+   std::vector<float> adapt(1024), contrast(1024);
+   for (int i = 0; i < 1024; i++) {
+      adapt[i] = powf(10.0f, -3.0f + 7.0f * i / 1024);
+      contrast[i] = powf(10.0f, -4.0f + 4.0f * i / 1024);
+   }
+   volatile float sink = 0;
+   Run(opts, "tvi_csf_mask", w, h, -1, [&]() {
+      float sum = 0;
+      for (int i = 0; i < w * h; i++) {
+         const float a = adapt[i & 1023];
+         sum += tvi(a) + csf(0.5f + (i & 63), a) + mask(contrast[(i >> 10) & 1023]);
+      }
+      sink = sum;
+   });
+
+   Run(opts, "downsample", w, h, -1, [&]() {
+      delete img->DownSample();
+   });
+   Run(opts, "downsample_3", w, h, -1, [&]() {
+      delete img->DownSample(3);
+   });
+
+   // A mapped PPM is only paged in once its pixels are read, so read_ppm
+   // measures the loader alone; the PNG goes through FreeImage's decoder
+   const std::string ppm = opts.TmpDir + "/perceptualdiff_bench.ppm";
+   if (Write_PPM(ppm, pixels.get(), w, h)) {
+      Run(opts, "read_ppm", w, h, -1, [&]() {
+         delete RGBAFloatImage::ReadFromFile(ppm.c_str());
+      });
+      remove(ppm.c_str());
+   }
+   const std::string png = opts.TmpDir + "/perceptualdiff_bench.png";
+   if (Write_PNG(png, pixels.get(), w, h)) {
+      Run(opts, "read_png", w, h, -1, [&]() {
+         delete RGBAFloatImage::ReadFromFile(png.c_str());
+      });
+      remove(png.c_str());
+   }
+
+   for (size_t d = 0; d < opts.Densities.size(); d++) {
+      const float density = opts.Densities[d];
+      std::shared_ptr<unsigned char> changed = Change_Pixels(pixels, w, h, density);
+      static const char *const modes[] = { "compare", "compare_decimated", "compare_half" };
+      for (int mode = 0; mode < 3; mode++) {
+         Run(opts, modes[mode], w, h, density, [&]() {
+            CompareArgs args;
+            args.ImgA = img->Share();
+            args.ImgB = Make_Image(w, h, "B", changed);
+            args.NumThreads = opts.NumThreads;
+            args.DecimatedPyramid = mode == 1;
+            args.HalfPrecision = mode == 2;
+            Yee_Compare(args);
+         });
+      }
+   }
+}
+
+// Splits a comma separated list of numbers
+template <typename T>
+static std::vector<T> Parse_List(const char *list)
+{
+   std::vector<T> values;
+   for (const char *p = list; *p; ) {
+      values.push_back((T) atof(p));
+      p = strchr(p, ',');
+      if (!p) break;
+      p++;
+   }
+   return values;
+}
+
+int main(int argc, char **argv)
+{
+   BenchOptions opts;
+   opts.Sizes = Parse_List<int>("256,1024,2048,4096,8192");
+   opts.Densities = Parse_List<float>("0,0.001,0.01,0.1,1");
+   opts.MinTime = 0.5;
+   opts.NumThreads = 0;
+   opts.TmpDir = "/tmp";
+   for (int i = 1; i < argc; i++) {
+      const bool value = i + 1 < argc;
+      if (strcmp(argv[i], "-sizes") == 0 && value) {
+         opts.Sizes = Parse_List<int>(argv[++i]);
+      } else if (strcmp(argv[i], "-densities") == 0 && value) {
+         opts.Densities = Parse_List<float>(argv[++i]);
+      } else if (strcmp(argv[i], "-mintime") == 0 && value) {
+         opts.MinTime = atof(argv[++i]);
+      } else if (strcmp(argv[i], "-threads") == 0 && value) {
+         opts.NumThreads = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-filter") == 0 && value) {
+         opts.Filter = argv[++i];
+      } else if (strcmp(argv[i], "-tmp") == 0 && value) {
+         opts.TmpDir = argv[++i];
+      } else {
+         printf("%s", usage);
+         return -1;
+      }
+   }
+
+   printf("benchmark\twidth\theight\tdensity\titerations\tms_per_iteration\tmpixels_per_second\n");
+   for (size_t i = 0; i < opts.Sizes.size(); i++) {
+      if (opts.Sizes[i] > 0) Bench_Size(opts, opts.Sizes[i]);
+   }
+   return 0;
+}
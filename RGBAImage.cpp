@@ -17,40 +17,130 @@ if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330,
 */
 
 #include "RGBAImage.h"
+#include "AlignedBuffer.h"
+#include "MappedImage.h"
 #include <cstdio>
 #include <cstring>
 #include <cstdint> // uint8_t, uint32_t, etc.
+#include <vector>
+
+RGBAFloatImage::RGBAFloatImage(int w, int h, const char *name) :
+   Width(w),
+   Height(h),
+   Type(PIXEL_FLOAT),
+   Channels(4),
+   RowStride(w * sizeof(RGBAFloat)),
+   FloatRGBA(true)
+{
+   if (name) Name = name;
+   std::shared_ptr<RGBAFloat> pixels = Aligned_Shared<RGBAFloat>((size_t) w * h);
+   Data = pixels.get();
+   Owner = pixels;
+   TopRow = reinterpret_cast<const unsigned char *>(Data);
+   for (int i = 0; i < 4; i++) Offset[i] = i;
+}
+
+RGBAFloatImage::RGBAFloatImage(int w, int h, const char *name, PixelType type, int channels,
+   const int offset[4], const void *top_row, ptrdiff_t row_stride,
+   const std::shared_ptr<void> &owner) :
+   Width(w),
+   Height(h),
+   Type(type),
+   Channels(channels),
+   TopRow(static_cast<const unsigned char *>(top_row)),
+   RowStride(row_stride),
+   Owner(owner),
+   Data(0)
+{
+   if (name) Name = name;
+   for (int i = 0; i < 4; i++) Offset[i] = offset[i];
+   FloatRGBA = Type == PIXEL_FLOAT && Channels == 4 &&
+      Offset[0] == 0 && Offset[1] == 1 && Offset[2] == 2 && Offset[3] == 3;
+}
+
+// Components of value one map to 1.0
+template <typename T>
+static void Convert_Components(const T *src, int n, int channels, const int offset[4],
+   float one, RGBAFloat *out)
+{
+   for (int i = 0; i < n; i++, src += channels) {
+      out[i].mR = src[offset[0]] / one;
+      out[i].mG = src[offset[1]] / one;
+      out[i].mB = src[offset[2]] / one;
+      out[i].mA = offset[3] >= 0 ? src[offset[3]] / one : 1.0f;
+   }
+}
+
+void RGBAFloatImage::Get_Span(int x, int y, int n, RGBAFloat *out) const
+{
+   const unsigned char *row = Get_Raw_Row(y);
+   switch (Type) {
+   case PIXEL_UINT8:
+      for (int i = 0; i < n; i++) {
+         const RGBAInt32Comp *p = row + (x + i) * Channels;
+         out[i].Set(p[Offset[0]], p[Offset[1]], p[Offset[2]],
+            Offset[3] >= 0 ? p[Offset[3]] : (RGBAInt32Comp) 255);
+      }
+      break;
+   case PIXEL_UINT16:
+      Convert_Components(reinterpret_cast<const uint16_t *>(row) + x * Channels, n, Channels,
+         Offset, 65535.0f, out);
+      break;
+   case PIXEL_FLOAT:
+      Convert_Components(reinterpret_cast<const float *>(row) + x * Channels, n, Channels,
+         Offset, 1.0f, out);
+      break;
+   }
+}
 
-RGBAFloatImage* RGBAFloatImage::DownSample() const {
-   if (Width <=1 || Height <=1)
+// Averages the 2x2 patches of rows r0 and r1 into n pixels of out, adding
+// the four pixels in the order DownSample always has
+static void Average_Patches(const RGBAFloat *r0, const RGBAFloat *r1, int n, RGBAFloat *out)
+{
+   const float *a = reinterpret_cast<const float *>(r0);
+   const float *b = reinterpret_cast<const float *>(r1);
+   float *o = reinterpret_cast<float *>(out);
+   for (int i = 0; i < 4 * n; i++) {
+      const int j = (i & ~3) * 2 + (i & 3);
+      o[i] = (a[j] + a[j + 4] + b[j] + b[j + 4]) / 4;
+   }
+}
+
+RGBAFloatImage* RGBAFloatImage::DownSample(int levels) const {
+   // Each level halves the size, rounding down, until a side is 1
+   int n = 0, nw = Width, nh = Height;
+   while (n < levels && nw > 1 && nh > 1) {
+      nw /= 2;
+      nh /= 2;
+      n++;
+   }
+   if (n == 0)
       return NULL;
 
-   int nw = Width / 2;
-   int nh = Height / 2;
    RGBAFloatImage* img = new RGBAFloatImage(nw, nh, Name.c_str());
 
+   // A row of the result averages a strip of 2^n rows, read straight from
+   // the storage format. The strip is halved level by level between two
+   // buffers, giving the same sums as n separate passes.
+   const int rows = 1 << n;
+   std::vector<RGBAFloat, AlignedAllocator<RGBAFloat> > strip(rows * (size_t) Width);
+   std::vector<RGBAFloat, AlignedAllocator<RGBAFloat> > half(rows / 2 * (size_t) (Width / 2));
    for (int y = 0; y < nh; y++) {
-      for (int x = 0; x < nw; x++) {
-         RGBAFloat d[4];
-
-         // Sample a 2x2 patch from the parent image.
-         d[0] = Get(2 * x + 0, 2 * y + 0);
-         d[1] = Get(2 * x + 1, 2 * y + 0);
-         d[2] = Get(2 * x + 0, 2 * y + 1);
-         d[3] = Get(2 * x + 1, 2 * y + 1);
-
-         // Compute average color.
-         RGBAFloat avgColor(0);
-         for (int i = 0; i < 4; i++) {
-            RGBAFloatComp c;
-            c  = d[0].GetComp(i);
-            c += d[1].GetComp(i);
-            c += d[2].GetComp(i);
-            c += d[3].GetComp(i);
-            c /= 4;
-            avgColor.GetComp(i) = c;
+      for (int r = 0; r < rows; r++) {
+         Get_Span(0, y * rows + r, Width, &strip[r * (size_t) Width]);
+      }
+      RGBAFloat *src = &strip[0];
+      RGBAFloat *dst = &half[0];
+      int w = Width;
+      for (int level = 1; level <= n; level++) {
+         const int lw = w / 2;
+         if (level == n) dst = &img->Data[y * (size_t) nw];
+         for (int r = 0; r < rows >> level; r++) {
+            Average_Patches(src + 2 * r * (size_t) w, src + (2 * r + 1) * (size_t) w, lw,
+               dst + r * (size_t) lw);
          }
-         img->Set(avgColor, x, y);
+         std::swap(src, dst);
+         w = lw;
       }
    }
 
@@ -126,78 +216,91 @@ bool RGBAFloatImage::CanOpenFile(const char *filename) {
       return false;
 }
 
-RGBAFloatImage* RGBAFloatImage::ReadFromFile(const char* filename) {
+// Reports why filename cannot be read
+static void Read_Error(std::string *error, const char *reason, const char *filename)
+{
+   if (error) {
+      *error = reason;
+      *error += filename;
+   } else {
+      fprintf(stderr, "%s%s\n", reason, filename);
+   }
+}
+
+RGBAFloatImage* RGBAFloatImage::ReadFromFile(const char* filename, std::string *error) {
    if (!CanOpenFile(filename)) {
-      printf("Cannot open %s\n", filename);
+      Read_Error(error, "Cannot open ", filename);
       return 0;
    }
 
+   // Simple uncompressed formats are read in place from the file
+   if (RGBAFloatImage *mapped = Read_Mapped_Image(filename))
+      return mapped;
+
    const FREE_IMAGE_FORMAT fileType = FreeImage_GetFileType(filename);
    if(FIF_UNKNOWN == fileType) {
-      printf("Unknown filetype %s\n", filename);
+      Read_Error(error, "Unknown filetype ", filename);
       return 0;
    }
 
-   int bpp = 0;
-   FREE_IMAGE_TYPE origImageType = FIT_UNKNOWN;
-
-   FIBITMAP* freeImage = 0;
-   if(FIBITMAP* temporary = FreeImage_Load(fileType, filename, 0))
-   {
-      bpp = FreeImage_GetBPP(temporary);
-      origImageType = FreeImage_GetImageType(temporary);
-
-      if ((origImageType == FIT_BITMAP) || (origImageType == FIT_RGB16) || (origImageType == FIT_RGBA16)) {
-         freeImage = FreeImage_ConvertTo32Bits(temporary);
-         FreeImage_Unload(temporary);
-      } else if ((origImageType == FIT_RGBF) || (origImageType == FIT_RGBAF)) {
-         // Float
-         freeImage = temporary;
+   FIBITMAP* freeImage = FreeImage_Load(fileType, filename, 0);
+   if (freeImage) {
+      // 24 and 32 bit bitmaps are used as they are, anything else with a
+      // palette or fewer bits is expanded to 32 bits first
+      const unsigned bpp = FreeImage_GetBPP(freeImage);
+      if (FreeImage_GetImageType(freeImage) == FIT_BITMAP && bpp != 24 && bpp != 32) {
+         FIBITMAP* converted = FreeImage_ConvertTo32Bits(freeImage);
+         FreeImage_Unload(freeImage);
+         freeImage = converted;
       }
    }
    if(!freeImage)
    {
-      printf( "Failed to load the image %s\n", filename);
+      Read_Error(error, "Failed to load the image ", filename);
       return 0;
    }
 
-   const int w = FreeImage_GetWidth(freeImage);
-   const int h = FreeImage_GetHeight(freeImage);
-
-   RGBAFloatImage* result = new RGBAFloatImage(w, h, filename);
-   // Copy the image over to our internal format, FreeImage has scanlines bottom to top though.
-   int resIdx = 0;
-   if ((origImageType == FIT_BITMAP) || (origImageType == FIT_RGB16) || (origImageType == FIT_RGBA16)) {
-      for (int y = 0; y < h; y++) {
-         const RGBAInt32* scanline =
-            reinterpret_cast<const RGBAInt32*>(FreeImage_GetScanLine(freeImage, h - y - 1));
-         for (int x = 0; x < w; x++, resIdx++)
-            result->Set(scanline[x], resIdx);
-      }
-   } else if (origImageType == FIT_RGBF) {
-      for (int y = 0; y < h; y++) {
-         const RGBAFloatComp(*scanlineTriplet)[3] =
-            reinterpret_cast<const RGBAFloatComp(*)[3]>(
-               reinterpret_cast<const void*>(
-                  FreeImage_GetScanLine(freeImage, h - y - 1)));
-         for (int x = 0; x < w; x++, resIdx++) {
-            result->Set(scanlineTriplet[x], resIdx);
-         }
-      }
-   } else if (origImageType == FIT_RGBAF) {
-      for (int y = 0; y < h; y++) {
-         const RGBAFloatComp(*scanlineQuad)[4] =
-            reinterpret_cast<const RGBAFloatComp(*)[4]>(
-               reinterpret_cast<const void*>(
-                  FreeImage_GetScanLine(freeImage, h - y - 1)));
-         for (int x = 0; x < w; x++, resIdx++) {
-            result->Set(scanlineQuad[x], resIdx);
-         }
-      }
+   PixelType type;
+   int channels;
+   int offset[4] = { 0, 1, 2, 3 };
+   switch (FreeImage_GetImageType(freeImage)) {
+   case FIT_BITMAP:
+      type = PIXEL_UINT8;
+      channels = FreeImage_GetBPP(freeImage) / 8;
+      offset[0] = FI_RGBA_RED;
+      offset[1] = FI_RGBA_GREEN;
+      offset[2] = FI_RGBA_BLUE;
+      offset[3] = channels == 4 ? FI_RGBA_ALPHA : -1;
+      break;
+   case FIT_RGB16:
+      type = PIXEL_UINT16;
+      channels = 3;
+      offset[3] = -1;
+      break;
+   case FIT_RGBA16:
+      type = PIXEL_UINT16;
+      channels = 4;
+      break;
+   case FIT_RGBF:
+      type = PIXEL_FLOAT;
+      channels = 3;
+      offset[3] = -1;
+      break;
+   case FIT_RGBAF:
+      type = PIXEL_FLOAT;
+      channels = 4;
+      break;
+   default:
+      Read_Error(error, "Failed to load the image ", filename);
+      FreeImage_Unload(freeImage);
+      return 0;
    }
 
-   FreeImage_Unload(freeImage);
-   return result;
+   // The image keeps the bitmap alive and reads it in place; FreeImage has
+   // scanlines bottom to top, hence the negative stride.
+   const int w = FreeImage_GetWidth(freeImage);
+   const int h = FreeImage_GetHeight(freeImage);
+   std::shared_ptr<void> owner(freeImage, FreeImage_Unload);
+   return new RGBAFloatImage(w, h, filename, type, channels, offset,
+      FreeImage_GetScanLine(freeImage, h - 1), -(ptrdiff_t) FreeImage_GetPitch(freeImage), owner);
 }
-
-
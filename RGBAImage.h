@@ -14,15 +14,18 @@ You should have received a copy of the GNU General Public License along with thi
 if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
-#ifndef _RGAIMAGE_H
+#ifndef _RGBAIMAGE_H
 #define _RGBAIMAGE_H
 
 #include "FreeImage.h"
 
 #include <string>
+#include <memory>
+#include <cstddef>
 #include <cstdint> // uint8_t, uint32_t, etc.
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 
 template <typename T>
 inline T Clamp(const T& n, const T& lower, const T& upper)
@@ -150,16 +153,24 @@ public:
       rgb[3] = mA;
    }
 
-   bool operator==(const RGBAFloat& a) {
+   bool operator==(const RGBAFloat& a) const {
       return mR == a.mR && mG == a.mG && mB == a.mB && mA == a.mA;
    }
-   bool operator!=(const RGBAFloat& a) {
+   bool operator!=(const RGBAFloat& a) const {
       return !operator==(a);
    }
 
    RGBAFloatComp mR, mG, mB, mA;
 };
 
+// Storage type of the components of an image
+enum PixelType
+{
+   PIXEL_UINT8,    // value i / 255
+   PIXEL_UINT16,   // value i / 65535
+   PIXEL_FLOAT
+};
+
 /** Class encapsulating an image containing float-based R,G,B,A channels.
  *
  * Internal representation assumes data is in the ABGR format, with the RGB
@@ -174,14 +185,19 @@ class RGBAFloatImage
    RGBAFloatImage& operator=(const RGBAFloatImage&);
 
 public:
-   RGBAFloatImage(int w, int h, const char *name = 0) {
-      Width = w;
-      Height = h;
-      if (name) Name = name;
-      Data = new RGBAFloat[w * h];
-   };
-   ~RGBAFloatImage() { if (Data) delete[] Data; }
+   // Float RGBA image owning its pixels, such as the difference image
+   RGBAFloatImage(int w, int h, const char *name = 0);
+   // Image over pixels kept alive by owner, typically the decoded file, so
+   // loading needs no copy. Each pixel is `channels` components of the given
+   // type, with red, green, blue and alpha at component offsets offset[0..3];
+   // a negative alpha offset means opaque. Row y starts at
+   // top_row + y * row_stride bytes, the stride being negative for
+   // bottom-up storage.
+   RGBAFloatImage(int w, int h, const char *name, PixelType type, int channels,
+      const int offset[4], const void *top_row, ptrdiff_t row_stride,
+      const std::shared_ptr<void> &owner);
 
+   // The setters and integer getters need an image made by the first constructor
    void Set(RGBAFloat rgba, int x, int y) {
       Data[x + y * Width] = rgba;
    }
@@ -210,13 +226,6 @@ public:
    void Set(RGBAInt32 rgba, int i) {
       Data[i].Set(rgba);
    }
-
-   RGBAFloat Get(int x, int y) const {
-      return Data[x + y * Width];
-   }
-   RGBAFloat Get(int i) const {
-      return Data[i];
-   }
    uint32_t GetInt32(int i) {
       return Data[i].GetInt32();
    }
@@ -227,17 +236,36 @@ public:
       Data[i].GetRGBQuad(rgb);
    }
 
-   RGBAFloatComp Get_Red(unsigned int i) {
-      return Data[i].mR;
+   RGBAFloat Get(int x, int y) const {
+      RGBAFloat p;
+      Get_Span(x, y, 1, &p);
+      return p;
+   }
+   RGBAFloat Get(int i) const {
+      return Get(i % Width, i / Width);
+   }
+   // Converts n pixels of row y, starting at x, to float
+   void Get_Span(int x, int y, int n, RGBAFloat *out) const;
+   // Row y if it is stored as RGBAFloat, otherwise NULL
+   const RGBAFloat *Get_Row(int y) const {
+      return FloatRGBA ? reinterpret_cast<const RGBAFloat *>(Get_Raw_Row(y)) : 0;
+   }
+   // Row y in the storage format
+   const unsigned char *Get_Raw_Row(int y) const {
+      return TopRow + y * RowStride;
+   }
+
+   RGBAFloatComp Get_Red(unsigned int i) const {
+      return Get(i).mR;
    }
-   RGBAFloatComp Get_Green(unsigned int i) {
-      return Data[i].mG;
+   RGBAFloatComp Get_Green(unsigned int i) const {
+      return Get(i).mG;
    }
-   RGBAFloatComp Get_Blue(unsigned int i) {
-      return Data[i].mB;
+   RGBAFloatComp Get_Blue(unsigned int i) const {
+      return Get(i).mB;
    }
-   RGBAFloatComp Get_Alpha(unsigned int i) {
-      return Data[i].mA;
+   RGBAFloatComp Get_Alpha(unsigned int i) const {
+      return Get(i).mA;
    }
 
    int Get_Width(void) const {
@@ -246,14 +274,38 @@ public:
    int Get_Height(void) const {
       return Height;
    }
+   PixelType Get_Type(void) const {
+      return Type;
+   }
+   int Get_Channels(void) const {
+      return Channels;
+   }
+   // Bytes from one row to the next, negative for bottom-up storage
+   ptrdiff_t Get_Row_Stride(void) const {
+      return RowStride;
+   }
+   // Component offsets of red, green, blue and alpha within a pixel
+   const int *Get_Offsets(void) const {
+      return Offset;
+   }
 
    const std::string &Get_Name(void) const {
       return Name;
    }
-   RGBAFloatImage* DownSample() const;
+   // Another image over the same pixels, which stay alive until both are deleted
+   RGBAFloatImage *Share() const {
+      return new RGBAFloatImage(Width, Height, Name.c_str(), Type, Channels, Offset, TopRow,
+         RowStride, Owner);
+   }
+   // Float image of half the size per level, each pixel the average of a
+   // 2x2 patch of the level above; levels stop once a side is 1. NULL if
+   // no level is possible.
+   RGBAFloatImage* DownSample(int levels = 1) const;
 
    bool WriteToFile(const char* filename);
-   static RGBAFloatImage* ReadFromFile(const char* filename);
+   // NULL if the file cannot be read, the reason going to error when it is
+   // given and to stderr otherwise
+   static RGBAFloatImage* ReadFromFile(const char* filename, std::string *error = 0);
 
 protected:
    static bool CanOpenFile(const char *filename);
@@ -262,6 +314,13 @@ protected:
    int Width;
    int Height;
    std::string Name;
+   PixelType Type;
+   int Channels;
+   int Offset[4];
+   const unsigned char *TopRow;
+   ptrdiff_t RowStride;
+   bool FloatRGBA;
+   std::shared_ptr<void> Owner;
    RGBAFloat *Data;
 };
 
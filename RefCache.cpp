@@ -0,0 +1,185 @@
+/*
+RefCache
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "RefCache.h"
+#include "CompareArgs.h"
+#include "FileUtil.h"
+#include "RGBAImage.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char RefCacheMagic[8] = { 'P', 'D', 'R', 'E', 'F', 0, 0, 0 };
+static const uint32_t RefCacheVersion = 2;
+static const int RefCachePlanes = MAX_PYR_LEVELS + 2;
+
+RefCache::RefCache() :
+   Width(0),
+   Height(0),
+   Mapping(0),
+   MappingSize(0)
+{
+   for (int i = 0; i < RefCachePlanes; i++) Planes[i] = 0;
+}
+
+RefCache::~RefCache()
+{
+#ifndef _WIN32
+   if (Mapping) munmap(Mapping, MappingSize);
+#endif
+}
+
+bool RefCache::Make_Header(const CompareArgs &args)
+{
+   static_assert(sizeof(RefCacheHeader) == 64, "RefCacheHeader must stay 64 bytes");
+
+   struct stat st;
+   uint64_t hash;
+   const char *source = args.ImgA->Get_Name().c_str();
+   if (stat(source, &st) != 0 || !Hash_File(source, hash)) return false;
+
+   memset(&Header, 0, sizeof(Header));
+   memcpy(Header.Magic, RefCacheMagic, sizeof(Header.Magic));
+   Header.Version = RefCacheVersion;
+   Header.Width = args.ImgA->Get_Width();
+   Header.Height = args.ImgA->Get_Height();
+   Header.Levels = MAX_PYR_LEVELS;
+   Header.Gamma = args.Gamma;
+   Header.Luminance = args.Luminance;
+   Header.ExactMath = args.ExactMath ? 1 : 0;
+   Header.DownSample = args.DownSample;
+   Header.SourceSize = st.st_size;
+   Header.SourceHash = hash;
+   Width = Header.Width;
+   Height = Header.Height;
+   return true;
+}
+
+RefCache *RefCache::Open(const char *path, const CompareArgs &args)
+{
+   RefCache *cache = new RefCache;
+   RefCacheHeader header;
+   const size_t plane = (size_t) args.ImgA->Get_Width() * args.ImgA->Get_Height();
+   const size_t size = sizeof(header) + RefCachePlanes * plane * sizeof(float);
+   char *data = 0;
+
+   FILE *f = fopen(path, "rb");
+   bool valid = f && cache->Make_Header(args) &&
+      fread(&header, sizeof(header), 1, f) == 1 &&
+      memcmp(&header, &cache->Header, sizeof(header)) == 0;
+   if (valid) {
+      fseek(f, 0, SEEK_END);
+      valid = (size_t) ftell(f) == size;
+   }
+#ifndef _WIN32
+   if (f) fclose(f);
+   if (valid) {
+      // Private and writable so the planes can be handed out as float *,
+      // nothing ever writes to them
+      int fd = open(path, O_RDONLY);
+      void *m = fd >= 0 ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+      if (fd >= 0) close(fd);
+      if (m != MAP_FAILED) {
+         cache->Mapping = m;
+         cache->MappingSize = size;
+         data = static_cast<char *>(m) + sizeof(header);
+      }
+   }
+#else
+   if (valid) {
+      cache->Memory.resize(RefCachePlanes * plane);
+      fseek(f, sizeof(header), SEEK_SET);
+      if (fread(&cache->Memory[0], sizeof(float), cache->Memory.size(), f) == cache->Memory.size())
+         data = reinterpret_cast<char *>(&cache->Memory[0]);
+   }
+   if (f) fclose(f);
+#endif
+   if (!data) {
+      delete cache;
+      return NULL;
+   }
+   for (int i = 0; i < RefCachePlanes; i++) {
+      cache->Planes[i] = reinterpret_cast<float *>(data) + i * plane;
+   }
+   return cache;
+}
+
+RefCache *RefCache::Create(const CompareArgs &args)
+{
+   RefCache *cache = new RefCache;
+   if (!cache->Make_Header(args)) {
+      delete cache;
+      return NULL;
+   }
+   const size_t plane = (size_t) cache->Width * cache->Height;
+   cache->Memory.resize(RefCachePlanes * plane);
+   for (int i = 0; i < RefCachePlanes; i++) {
+      cache->Planes[i] = &cache->Memory[0] + i * plane;
+   }
+   return cache;
+}
+
+bool RefCache::Save(const char *path) const
+{
+   // Written next to the destination under a name of its own and renamed
+   // into place, so concurrent comparisons never see a partial file
+   std::string tmp;
+   FILE *f = Open_Temp(path, tmp);
+   if (!f) return false;
+   const size_t plane = (size_t) Width * Height;
+   bool ok = fwrite(&Header, sizeof(Header), 1, f) == 1;
+   for (int i = 0; ok && i < RefCachePlanes; i++) {
+      ok = fwrite(Planes[i], sizeof(float), plane, f) == plane;
+   }
+   ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+   if (ok) remove(path);
+#endif
+   if (!ok || rename(tmp.c_str(), path) != 0) {
+      remove(tmp.c_str());
+      return false;
+   }
+   return true;
+}
+
+bool RefCache::Matches(const CompareArgs &args) const
+{
+   RefCache current;
+   return current.Make_Header(args) && memcmp(&current.Header, &Header, sizeof(Header)) == 0;
+}
+
+std::shared_ptr<const RefCache> RefCacheSlot::Get(const CompareArgs &args)
+{
+   std::shared_ptr<const RefCache> cache;
+   {
+      std::lock_guard<std::mutex> lock(Mutex);
+      cache = Cache;
+   }
+   return cache && cache->Matches(args) ? cache : std::shared_ptr<const RefCache>();
+}
+
+void RefCacheSlot::Put(const std::shared_ptr<const RefCache> &cache)
+{
+   std::lock_guard<std::mutex> lock(Mutex);
+   Cache = cache;
+}
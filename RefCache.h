@@ -0,0 +1,114 @@
+/*
+RefCache
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _REFCACHE_H
+#define _REFCACHE_H
+
+#include "AlignedBuffer.h"
+#include "LPyramid.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class CompareArgs;
+
+// First 64 bytes of a .pdref file, followed by the planes in the order
+// levels 0 to MAX_PYR_LEVELS - 1, A, B
+struct RefCacheHeader
+{
+   char Magic[8];
+   uint32_t Version;
+   uint32_t Width;
+   uint32_t Height;
+   uint32_t Levels;
+   float Gamma;
+   float Luminance;
+   uint32_t ExactMath;
+   uint32_t DownSample;
+   uint64_t SourceSize;
+   uint64_t SourceHash;
+   uint32_t Reserved[2];
+};
+
+// Derived data of a reference image (the first image of a comparison):
+// every full resolution pyramid level of its luminance and its LAB A and B
+// channels, as float planes the size of the image.
+//
+// A .pdref file holds a header followed by those planes. The header records
+// the gamma, luminance, colour math, downsampling and the size and a hash
+// of the contents of the source file; a file is only used when all of them
+// match the current comparison. Timestamps are not used: a reference
+// rewritten within the clock's resolution would go unnoticed. The field of
+// view is not recorded as none of the stored data depends on it.
+//
+// The planes are kept in float, 40 bytes per pixel, so that a comparison
+// using the cache gives the same pixel counts as one without.
+class RefCache
+{
+public:
+   ~RefCache();
+
+   // Maps the cache file at path for the reference of args. Returns NULL
+   // if it is missing, unreadable or was made for other parameters.
+   static RefCache *Open(const char *path, const CompareArgs &args);
+   // Allocates empty planes for the reference of args, to be filled in
+   // while comparing and then written out with Save()
+   static RefCache *Create(const CompareArgs &args);
+   // Writes the planes to path, replacing any previous file atomically
+   bool Save(const char *path) const;
+   // Whether the planes were made for the reference and parameters of args
+   bool Matches(const CompareArgs &args) const;
+
+   int Get_Width() const { return Width; }
+   int Get_Height() const { return Height; }
+   float *Get_Level(int level) const { return Planes[level]; }
+   float *Get_A() const { return Planes[MAX_PYR_LEVELS]; }
+   float *Get_B() const { return Planes[MAX_PYR_LEVELS + 1]; }
+
+private:
+   RefCache();
+   RefCache(const RefCache&);
+   RefCache& operator=(const RefCache&);
+
+   bool Make_Header(const CompareArgs &args);
+
+   int Width;
+   int Height;
+   float *Planes[MAX_PYR_LEVELS + 2];
+   RefCacheHeader Header;
+   AlignedFloats Memory;        // planes of a created cache
+   void *Mapping;               // file of an opened one
+   size_t MappingSize;
+};
+
+// Keeps the derived data of one reference image in memory between
+// comparisons, such as those of the server, running on any thread
+class RefCacheSlot
+{
+public:
+   // The cache last put here if it matches args, otherwise NULL
+   std::shared_ptr<const RefCache> Get(const CompareArgs &args);
+   // Replaces the cache with a complete one
+   void Put(const std::shared_ptr<const RefCache> &cache);
+
+private:
+   std::mutex Mutex;
+   std::shared_ptr<const RefCache> Cache;
+};
+
+#endif
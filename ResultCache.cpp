@@ -0,0 +1,216 @@
+/*
+ResultCache
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "ResultCache.h"
+#include "CompareArgs.h"
+#include "FileUtil.h"
+#include "RGBAImage.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Bump when a change to the metric alters verdicts or pixel counts
+static const int ResultCacheVersion = 1;
+
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+
+static inline uint64_t Rotate(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Load64(const unsigned char *p)
+{
+   uint64_t v;
+   memcpy(&v, p, 8);
+   return v;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input)
+{
+   acc += input * Prime2;
+   return Rotate(acc, 31) * Prime1;
+}
+
+// Four independent lanes over 32 byte blocks, then the tail
+HashStream::HashStream(uint64_t seed) :
+   Seed(seed),
+   Size(0),
+   NumPending(0)
+{
+   Lanes[0] = seed + Prime1 + Prime2;
+   Lanes[1] = seed + Prime2;
+   Lanes[2] = seed;
+   Lanes[3] = seed - Prime1;
+}
+
+void HashStream::Update(const void *data, size_t size)
+{
+   const unsigned char *p = static_cast<const unsigned char *>(data);
+   const unsigned char *end = p + size;
+   Size += size;
+   if (NumPending) {
+      const size_t n = std::min((size_t) (32 - NumPending), size);
+      memcpy(Pending + NumPending, p, n);
+      NumPending += n;
+      p += n;
+      if (NumPending < 32) return;
+      for (int i = 0; i < 4; i++) Lanes[i] = Round(Lanes[i], Load64(Pending + 8 * i));
+      NumPending = 0;
+   }
+   for (; p + 32 <= end; p += 32) {
+      Lanes[0] = Round(Lanes[0], Load64(p));
+      Lanes[1] = Round(Lanes[1], Load64(p + 8));
+      Lanes[2] = Round(Lanes[2], Load64(p + 16));
+      Lanes[3] = Round(Lanes[3], Load64(p + 24));
+   }
+   memcpy(Pending, p, end - p);
+   NumPending = end - p;
+}
+
+uint64_t HashStream::Final() const
+{
+   uint64_t h;
+   if (Size >= 32) {
+      h = Rotate(Lanes[0], 1) + Rotate(Lanes[1], 7) + Rotate(Lanes[2], 12) + Rotate(Lanes[3], 18);
+      for (int i = 0; i < 4; i++) h = (h ^ Round(0, Lanes[i])) * Prime1 + Prime3;
+   } else {
+      h = Seed + Prime3;
+   }
+   h += Size;
+   const unsigned char *p = Pending;
+   const unsigned char *end = p + NumPending;
+   for (; p + 8 <= end; p += 8) h = Rotate(h ^ Round(0, Load64(p)), 27) * Prime1 + Prime3;
+   for (; p < end; p++) h = Rotate(h ^ (*p * Prime3), 11) * Prime1;
+
+   h ^= h >> 33;
+   h *= Prime2;
+   h ^= h >> 29;
+   h *= Prime3;
+   h ^= h >> 32;
+   return h;
+}
+
+uint64_t Hash_Bytes(const void *data, size_t size, uint64_t seed)
+{
+   HashStream hash(seed);
+   hash.Update(data, size);
+   return hash.Final();
+}
+
+// Every option that can change the verdict or the pixel count
+static std::string Options_Key(const CompareArgs &args)
+{
+   char buf[256];
+   sprintf(buf, "%d %.9g %.9g %.9g %d %u %.9g %d %d %d %d %d", ResultCacheVersion,
+      args.FieldOfView, args.Gamma, args.Luminance, args.LuminanceOnly ? 1 : 0,
+      args.ThresholdPixels, args.ColorFactor, args.DownSample,
+      args.DecimatedPyramid ? 1 : 0, args.ExactMath ? 1 : 0, args.FailFast ? 1 : 0,
+      args.HalfPrecision ? 1 : 0);
+   return buf;
+}
+
+static std::string Make_Key(char tier, uint64_t a, uint64_t b, const CompareArgs &args)
+{
+   std::string options = Options_Key(args);
+   char key[64];
+   sprintf(key, "%c%016llx%016llx%016llx", tier, (unsigned long long) a, (unsigned long long) b,
+      (unsigned long long) Hash_Bytes(options.data(), options.size(), 0));
+   return key;
+}
+
+ResultCache::ResultCache(const std::string &dir) :
+   Dir(dir)
+{
+}
+
+std::string ResultCache::File_Key(const char *file_a, const char *file_b, const CompareArgs &args)
+{
+   uint64_t a, b;
+   if (!Hash_File(file_a, a) || !Hash_File(file_b, b)) return std::string();
+   return Make_Key('f', a, b, args);
+}
+
+std::string ResultCache::Pixel_Key(const CompareArgs &args)
+{
+   // The pixels are hashed as floats, so images stored in different
+   // formats but holding the same values get the same key
+   uint64_t h[2];
+   const RGBAFloatImage *img[2] = { args.ImgA, args.ImgB };
+   for (int i = 0; i < 2; i++) {
+      const int size[2] = { img[i]->Get_Width(), img[i]->Get_Height() };
+      std::vector<RGBAFloat> row(size[0]);
+      h[i] = Hash_Bytes(size, sizeof(size), 0);
+      for (int y = 0; y < size[1]; y++) {
+         img[i]->Get_Span(0, y, size[0], &row[0]);
+         h[i] = Hash_Bytes(&row[0], sizeof(RGBAFloat) * size[0], h[i]);
+      }
+   }
+   return Make_Key('p', h[0], h[1], args);
+}
+
+bool ResultCache::Lookup(const std::string &key, bool &passed, unsigned int &pixels_failed,
+   std::string &message) const
+{
+   FILE *f = fopen((Dir + "/" + key).c_str(), "rb");
+   if (!f) return false;
+   char verdict[8];
+   unsigned int pixels;
+   bool ok = fscanf(f, "%7s %u", verdict, &pixels) == 2 && fgetc(f) == '\n';
+   std::string text;
+   char chunk[256];
+   size_t n;
+   while (ok && (n = fread(chunk, 1, sizeof(chunk), f)) > 0) text.append(chunk, n);
+   fclose(f);
+   if (!ok || (strcmp(verdict, "PASS") != 0 && strcmp(verdict, "FAIL") != 0)) return false;
+
+   passed = strcmp(verdict, "PASS") == 0;
+   pixels_failed = pixels;
+   message = text;
+   return true;
+}
+
+void ResultCache::Store(const std::string &key, bool passed, unsigned int pixels_failed,
+   const std::string &message) const
+{
+#ifdef _WIN32
+   _mkdir(Dir.c_str());
+#else
+   mkdir(Dir.c_str(), 0777);
+#endif
+   // Written under a name of its own and renamed into place
+   std::string path = Dir + "/" + key;
+   std::string tmp;
+   FILE *f = Open_Temp(path, tmp);
+   if (!f) return;
+   fprintf(f, "%s %u\n%s", passed ? "PASS" : "FAIL", pixels_failed, message.c_str());
+   if (fclose(f) != 0) {
+      remove(tmp.c_str());
+      return;
+   }
+#ifdef _WIN32
+   remove(path.c_str());
+#endif
+   if (rename(tmp.c_str(), path.c_str()) != 0) remove(tmp.c_str());
+}
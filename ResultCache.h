@@ -0,0 +1,69 @@
+/*
+ResultCache
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _RESULTCACHE_H
+#define _RESULTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+class CompareArgs;
+
+// 64-bit non-cryptographic hash, several GB/s on large buffers
+uint64_t Hash_Bytes(const void *data, size_t size, uint64_t seed);
+
+// Hash_Bytes of data given in pieces: Final() after any number of Update()
+// calls is Hash_Bytes of their concatenation
+class HashStream
+{
+public:
+   explicit HashStream(uint64_t seed);
+   void Update(const void *data, size_t size);
+   uint64_t Final() const;
+
+private:
+   uint64_t Seed;
+   uint64_t Lanes[4];
+   uint64_t Size;
+   // The start of a 32 byte block the lanes have not taken yet
+   unsigned char Pending[32];
+   size_t NumPending;
+};
+
+// Directory of comparison verdicts, one small file per key. Keys combine
+// hashes of the inputs with every option that can change the verdict, so
+// stale entries are never looked up and the directory can be shared.
+class ResultCache
+{
+public:
+   explicit ResultCache(const std::string &dir);
+
+   // Key for two files by their bytes, empty if either cannot be read
+   static std::string File_Key(const char *file_a, const char *file_b, const CompareArgs &args);
+   // Key for the decoded images args.ImgA and args.ImgB
+   static std::string Pixel_Key(const CompareArgs &args);
+
+   bool Lookup(const std::string &key, bool &passed, unsigned int &pixels_failed,
+      std::string &message) const;
+   void Store(const std::string &key, bool passed, unsigned int pixels_failed,
+      const std::string &message) const;
+
+private:
+   std::string Dir;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+Sequence
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "Sequence.h"
+#include "CompareArgs.h"
+#include "Metric.h"
+#include "RGBAImage.h"
+#include "Stats.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A frame's comparison, loaded while the one before is compared
+struct SequenceFrame
+{
+   int Number;
+   std::unique_ptr<CompareArgs> Args;
+   bool Loaded;
+};
+
+// token with frame in place of its %d, %4d or %04d; a token without
+// exactly one such conversion is left as it is, %% being a percent sign
+static std::string Frame_Token(const std::string &token, int frame)
+{
+   std::string out;
+   int conversions = 0;
+   for (size_t i = 0; i < token.size(); i++) {
+      if (token[i] != '%') {
+         out += token[i];
+         continue;
+      }
+      if (i + 1 < token.size() && token[i + 1] == '%') {
+         out += '%';
+         i++;
+         continue;
+      }
+      size_t j = i + 1;
+      const bool zero = j < token.size() && token[j] == '0';
+      int width = 0;
+      for (; j < token.size() && token[j] >= '0' && token[j] <= '9' && width < 100; j++) {
+         width = width * 10 + token[j] - '0';
+      }
+      if (j == token.size() || token[j] != 'd') return token;
+      char number[128];
+      snprintf(number, sizeof(number), zero ? "%0*d" : "%*d", width, frame);
+      out += number;
+      conversions++;
+      i = j;
+   }
+   return conversions == 1 ? out : token;
+}
+
+static void Load_Frame(const std::vector<std::string> &common, int number, SequenceFrame &frame)
+{
+   std::vector<std::string> tokens;
+   for (size_t i = 0; i < common.size(); i++) tokens.push_back(Frame_Token(common[i], number));
+   std::vector<char *> argv;
+   for (size_t i = 0; i < tokens.size(); i++) argv.push_back(&tokens[i][0]);
+   argv.push_back(0);
+
+   frame.Number = number;
+   frame.Args.reset(new CompareArgs);
+   const bool parsed = frame.Args->Parse_Args((int) argv.size() - 1, &argv[0]);
+   fprintf(stderr, "%s", frame.Args->Warnings.c_str());
+   frame.Loaded = parsed && frame.Args->Load_Images();
+}
+
+int Run_Sequence(int first, int last, int argc, char **argv)
+{
+   // Verbose output would be interleaved between the frames and is dropped
+   int num_threads = 0;
+   std::vector<std::string> common;
+   common.push_back(argv[0]);
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-sequence") == 0) {
+         i += 2;
+      } else if (strcmp(argv[i], "-verbose") != 0) {
+         if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) num_threads = atoi(argv[i + 1]);
+         common.push_back(argv[i]);
+      }
+   }
+   if (first > last) {
+      fprintf(stderr, "Empty frame range %d to %d\n", first, last);
+      return -1;
+   }
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   // The frames are compared on this thread's workspace, the first one is
+   // loaded with it too, and the others are loaded on the loader's single
+   // worker while the frame before is compared
+   CompareWorkspace &workspace = Thread_Workspace(num_threads);
+   ThreadPool loader(2);
+   int passes = 0, fails = 0, errors = 0;
+   unsigned long long pixels_failed = 0;
+   SequenceFrame current;
+   Load_Frame(common, first, current);
+   for (int n = first; n <= last; n++) {
+      SequenceFrame next;
+      std::promise<void> loaded;
+      if (n < last) {
+         loader.Schedule([&common, &next, &loaded, n]() {
+            Load_Frame(common, n + 1, next);
+            loaded.set_value();
+         });
+      }
+
+      std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+      CompareArgs &args = *current.Args;
+      const char *result = "ERROR";
+      if (current.Loaded) {
+         args.Workspace = &workspace;
+         const bool passed = Yee_Compare(args);
+         result = passed ? "PASS" : "FAIL";
+         (passed ? passes : fails)++;
+         pixels_failed += args.PixelsFailed;
+         if (args.Stats && !args.Stats->Write_JSON(args.StatsFile.c_str(), args, passed)) {
+            fprintf(stderr, "Frame %d: could not write stats to %s\n", n, args.StatsFile.c_str());
+         }
+      } else {
+         errors++;
+         fprintf(stderr, "Frame %d: %s", n, args.ErrorStr.c_str());
+      }
+      const double ms = std::chrono::duration<double, std::milli>(
+         std::chrono::steady_clock::now() - frame_start).count();
+
+      char pixels[16] = "-";
+      if (current.Loaded) sprintf(pixels, "%u", args.PixelsFailed);
+      printf("%d\t%s\t%s\t%.1f\t%s\t%s\n", n, result, pixels, ms,
+         args.ImageFiles[0].c_str(), args.ImageFiles[1].c_str());
+      fflush(stdout);
+
+      if (n < last) loaded.get_future().wait();
+      current = std::move(next);
+   }
+
+   printf("# %d frames: %d PASS, %d FAIL, %d ERROR, %llu pixels failed, %.1f ms\n",
+      last - first + 1, passes, fails, errors, pixels_failed,
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+   return passes == last - first + 1 ? 0 : 1;
+}
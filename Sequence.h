@@ -0,0 +1,33 @@
+/*
+Sequence
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+
+#ifndef _SEQUENCE_H
+#define _SEQUENCE_H
+
+// Compares the frames first to last of an image sequence. Every argument
+// with one printf style %d conversion, such as render_%04d.png, has it
+// replaced by the frame number; the others apply to every frame. The next
+// frame is decoded while the current one is compared, and the threads and
+// working buffers are kept from one frame to the next. A tab separated
+//
+//    frame result pixels_failed milliseconds image1 image2
+//
+// line is printed per frame, result being PASS, FAIL or ERROR, followed by
+// a # line with the totals. Returns 0 if every frame passed, 1 otherwise.
+int Run_Sequence(int first, int last, int argc, char **argv);
+
+#endif
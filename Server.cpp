@@ -0,0 +1,369 @@
+/*
+Server
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "Server.h"
+#include <cstdio>
+
+#ifndef _WIN32
+
+#include "CompareArgs.h"
+#include "FileUtil.h"
+#include "Metric.h"
+#include "RGBAImage.h"
+#include "RefCache.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Number of reference images kept between requests
+#define SERVER_REFERENCES 8
+// Longest request read, in bytes
+#define SERVER_MAX_REQUEST (1 << 20)
+
+// A reference image as loaded from its file, and the derived data of its
+// last complete comparison. The file is recognised by its size and a hash
+// of its contents, as a timestamp misses a rewrite within its resolution.
+struct Reference
+{
+   std::string Path;
+   off_t Size;
+   uint64_t Hash;
+   std::unique_ptr<RGBAFloatImage> Image;
+   RefCacheSlot Derived;
+};
+
+// The most recently used reference images, most recent first
+class ReferenceCache
+{
+public:
+   // The entry of the file at path, loading it if it is not cached or has
+   // changed since; NULL if it cannot be loaded
+   std::shared_ptr<Reference> Get(const char *path);
+
+private:
+   std::mutex Mutex;
+   std::list<std::shared_ptr<Reference> > Entries;
+};
+
+std::shared_ptr<Reference> ReferenceCache::Get(const char *path)
+{
+   struct stat st;
+   uint64_t hash;
+   if (stat(path, &st) != 0 || !Hash_File(path, hash)) return std::shared_ptr<Reference>();
+   {
+      std::lock_guard<std::mutex> lock(Mutex);
+      for (std::list<std::shared_ptr<Reference> >::iterator i = Entries.begin();
+            i != Entries.end(); ++i) {
+         if ((*i)->Path != path) continue;
+         std::shared_ptr<Reference> ref = *i;
+         Entries.erase(i);
+         if (ref->Size != st.st_size || ref->Hash != hash) break;
+         Entries.push_front(ref);
+         return ref;
+      }
+   }
+
+   // Decoded without holding the lock, other requests carry on meanwhile
+   std::shared_ptr<Reference> ref(new Reference);
+   ref->Path = path;
+   ref->Size = st.st_size;
+   ref->Hash = hash;
+   ref->Image.reset(RGBAFloatImage::ReadFromFile(path));
+   if (!ref->Image) return std::shared_ptr<Reference>();
+
+   std::lock_guard<std::mutex> lock(Mutex);
+   Entries.push_front(ref);
+   if (Entries.size() > SERVER_REFERENCES) Entries.pop_back();
+   return ref;
+}
+
+static bool Is_One_Of(const std::string &arg, const char *const *list)
+{
+   for (; *list; list++) {
+      if (arg == *list) return true;
+   }
+   return false;
+}
+
+// Makes the file names among args[first..] absolute, taking relative ones
+// from dir: the images and the values of -output, -refcache, -cache etc.
+// "-", stdout for -stats, is left as it is.
+static void Resolve_Paths(std::vector<std::string> &args, size_t first, const std::string &dir)
+{
+   static const char *const value_options[] = {
+      "-fov", "-threshold", "-gamma", "-luminance", "-colorfactor", "-downsample", "-threads",
+      "-roi", 0
+   };
+   static const char *const file_options[] = {
+      "-output", "-refcache", "-cache", "-stats", "-failmask", "-failspans", "-failboxes",
+      "-mask", 0
+   };
+   for (size_t i = first; i < args.size(); i++) {
+      if (Is_One_Of(args[i], value_options)) {
+         i++;
+         continue;
+      }
+      if (Is_One_Of(args[i], file_options)) {
+         if (++i == args.size()) break;
+      } else if (!args[i].empty() && args[i][0] == '-') {
+         continue;
+      }
+      if (!args[i].empty() && args[i][0] != '/' && args[i] != "-") args[i] = dir + "/" + args[i];
+   }
+}
+
+static bool Socket_Address(const char *path, sockaddr_un &addr)
+{
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(addr.sun_path)) return false;
+   strcpy(addr.sun_path, path);
+   return true;
+}
+
+static bool Write_All(int fd, const std::string &data)
+{
+   for (size_t done = 0; done < data.size(); ) {
+      const ssize_t n = write(fd, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      done += n;
+   }
+   return true;
+}
+
+// Reads until the other end stops writing, or max bytes
+static std::string Read_All(int fd, size_t max)
+{
+   std::string data;
+   char chunk[4096];
+   while (data.size() < max) {
+      const ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      data.append(chunk, n);
+   }
+   return data;
+}
+
+static void Serve_Request(int fd, const std::vector<std::string> &common, ReferenceCache &refs)
+{
+   const std::string request = Read_All(fd, SERVER_MAX_REQUEST);
+   std::vector<std::string> words;
+   for (size_t start = 0, end; (end = request.find('\0', start)) != std::string::npos;
+         start = end + 1) {
+      words.push_back(request.substr(start, end - start));
+   }
+   if (words.empty()) return;
+
+   // The working directory is followed by the arguments
+   std::vector<std::string> tokens(common);
+   const size_t first = tokens.size();
+   tokens.insert(tokens.end(), words.begin() + 1, words.end());
+   Resolve_Paths(tokens, first, words[0]);
+
+   // As in a batch, the progress messages of -verbose would be interleaved
+   // between the requests and are dropped; a pass is still reported
+   bool verbose = false;
+   std::vector<char *> argv;
+   for (size_t i = 0; i < tokens.size(); i++) {
+      if (tokens[i] == "-verbose") verbose = true;
+      else argv.push_back(&tokens[i][0]);
+   }
+   argv.push_back(0);
+
+   // The reference comes from the cache, its derived data with it; ref
+   // keeps both alive until args is gone
+   std::shared_ptr<Reference> ref;
+   CompareArgs args;
+   args.LoadReference = [&](const char *path) -> RGBAFloatImage * {
+      ref = refs.Get(path);
+      if (!ref) return NULL;
+      args.RefSlot = &ref->Derived;
+      return ref->Image->Share();
+   };
+
+   // The same text and status as main
+   int status;
+   std::string text;
+   // The request runs on this thread alone, which keeps its buffers
+   const bool parsed = args.Parse_Args((int) argv.size() - 1, &argv[0]);
+   args.NumThreads = 1;
+   // The warnings go back to the client with the rest of the output; the
+   // reference's derived data is kept in float
+   std::string warning = args.Warnings;
+   if (args.HalfPrecision) {
+      warning += "Warning: -halfprecision ignored with -serve\n";
+      args.HalfPrecision = false;
+   }
+   if (!parsed || !args.Load_Images()) {
+      status = -1;
+      text = args.ErrorStr;
+   } else {
+      const bool passed = Yee_Compare(args);
+      status = passed ? 0 : 1;
+      if (!passed) text = "FAIL: " + args.ErrorStr + "\n";
+      else if (verbose) text = "PASS: " + args.ErrorStr + "\n";
+      // -stats - goes back to the client's stdout, after the result as in main
+      if (args.Stats && args.StatsFile == "-") {
+         text += args.Stats->JSON(args, passed);
+      } else if (args.Stats) {
+         args.Stats->Write_JSON(args.StatsFile.c_str(), args, passed);
+      }
+   }
+   char head[16];
+   sprintf(head, "%d\n", status);
+   Write_All(fd, head + warning + text);
+}
+
+int Run_Server(const char *path, int argc, char **argv)
+{
+   // Options shared by all requests, with file names relative to the
+   // server's directory; -threads sizes the pool of requests
+   int num_threads = 0;
+   std::vector<std::string> common;
+   common.push_back(argv[0]);
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-serve") == 0) {
+         i++;
+      } else if (strcmp(argv[i], "-threads") == 0) {
+         if (++i < argc) num_threads = atoi(argv[i]);
+      } else {
+         common.push_back(argv[i]);
+      }
+   }
+   char dir[4096];
+   if (getcwd(dir, sizeof(dir))) Resolve_Paths(common, 1, dir);
+
+   sockaddr_un addr;
+   if (!Socket_Address(path, addr)) {
+      fprintf(stderr, "Socket path too long: %s\n", path);
+      return -1;
+   }
+   // A socket left behind by an earlier server is replaced
+   struct stat st;
+   if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+   const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+         listen(fd, SOMAXCONN) != 0) {
+      fprintf(stderr, "Cannot listen on %s\n", path);
+      if (fd >= 0) close(fd);
+      return -1;
+   }
+   // A client may go away before its reply is written
+   signal(SIGPIPE, SIG_IGN);
+
+   // This thread only accepts connections, so the pool gets one more
+   ReferenceCache refs;
+   ThreadPool pool((num_threads > 0 ? num_threads : ThreadPool::Hardware_Threads()) + 1);
+   for (;;) {
+      const int conn = accept(fd, NULL, NULL);
+      if (conn < 0) {
+         if (errno == EINTR || errno == ECONNABORTED) continue;
+         fprintf(stderr, "Cannot accept connections on %s\n", path);
+         break;
+      }
+      pool.Schedule([&common, &refs, conn]() {
+         // A request that throws, e.g. out of memory on a huge image, gets
+         // an error reply and the server keeps serving the others
+         try {
+            Serve_Request(conn, common, refs);
+         } catch (const std::bad_alloc &) {
+            Write_All(conn, "-1\nFAIL: Out of memory\n");
+         } catch (const std::exception &e) {
+            Write_All(conn, std::string("-1\n") + "FAIL: " + e.what() + "\n");
+         } catch (...) {
+            Write_All(conn, "-1\nFAIL: Unexpected error\n");
+         }
+         close(conn);
+      });
+   }
+   close(fd);
+   return -1;
+}
+
+int Run_Client(const char *path, int argc, char **argv)
+{
+   sockaddr_un addr;
+   const int fd = Socket_Address(path, addr) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+   if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      fprintf(stderr, "Cannot connect to %s\n", path);
+      if (fd >= 0) close(fd);
+      return -1;
+   }
+
+   char dir[4096];
+   std::string request(getcwd(dir, sizeof(dir)) ? dir : ".");
+   request += '\0';
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-client") == 0) {
+         i++;
+      } else {
+         request += argv[i];
+         request += '\0';
+      }
+   }
+   signal(SIGPIPE, SIG_IGN);
+   const bool sent = Write_All(fd, request) && shutdown(fd, SHUT_WR) == 0;
+   const std::string reply = sent ? Read_All(fd, (size_t) -1) : std::string();
+   close(fd);
+
+   const size_t eol = reply.find('\n');
+   if (eol == std::string::npos) {
+      fprintf(stderr, "No reply from %s\n", path);
+      return -1;
+   }
+   // The warnings come first and go to stderr, as in a local run
+   size_t start = eol + 1;
+   while (reply.compare(start, 9, "Warning: ") == 0) {
+      const size_t end = reply.find('\n', start);
+      if (end == std::string::npos) break;
+      fwrite(reply.data() + start, 1, end + 1 - start, stderr);
+      start = end + 1;
+   }
+   fwrite(reply.data() + start, 1, reply.size() - start, stdout);
+   return atoi(reply.c_str());
+}
+
+#else
+
+int Run_Server(const char *, int, char **)
+{
+   fprintf(stderr, "-serve is not supported on this platform\n");
+   return -1;
+}
+
+int Run_Client(const char *, int, char **)
+{
+   fprintf(stderr, "-client is not supported on this platform\n");
+   return -1;
+}
+
+#endif
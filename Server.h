@@ -0,0 +1,39 @@
+/*
+Server
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+// Serves comparisons on the Unix domain socket at path until killed. The
+// process, its buffers and the most recently used reference images with
+// their derived data stay warm from one request to the next.
+//
+// A request is a command line as perceptualdiff takes it, sent as the
+// client's working directory and then the arguments, each terminated by a
+// NUL; relative file names are taken from that directory. The reply is the
+// exit status perceptualdiff would have returned, on a line of its own,
+// followed by the warnings it would have printed to stderr, each starting
+// with "Warning: ", and then the text it would have printed, without the
+// -verbose progress messages. The other arguments on the server's command line
+// apply to every request, before the request's own, and -threads sets how
+// many requests are served at once.
+int Run_Server(const char *path, int argc, char **argv);
+
+// Sends the command line, less "-client path", to the server at path,
+// prints its reply, the warnings to stderr, and returns its exit status
+int Run_Client(const char *path, int argc, char **argv);
+
+#endif
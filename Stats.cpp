@@ -0,0 +1,175 @@
+/*
+Stats
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "Stats.h"
+#include "AlignedBuffer.h"
+#include "CompareArgs.h"
+#include "RGBAImage.h"
+#include "ThreadPool.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+static const char *const StageNames[STATS_NUM_STAGES] = {
+   "decode", "downsample", "prepass", "convert", "pyramid", "metric", "write"
+};
+
+CompareStats::CompareStats() :
+   Start(std::chrono::steady_clock::now())
+{
+   for (int i = 0; i < STATS_NUM_STAGES; i++) {
+      Stages[i].Calls = 0;
+      Stages[i].WallNs = 0;
+      Stages[i].CpuNs = 0;
+      Stages[i].Bytes = 0;
+      Stages[i].Pixels = 0;
+      Stages[i].PeakRSS = 0;
+   }
+}
+
+void CompareStats::Add(StatsStage stage, uint64_t wall_ns, uint64_t cpu_ns, uint64_t bytes,
+   uint64_t pixels)
+{
+   Stage &s = Stages[stage];
+   s.Calls++;
+   s.WallNs += wall_ns;
+   s.CpuNs += cpu_ns;
+   s.Bytes += bytes;
+   s.Pixels += pixels;
+
+   // The peak so far, as of the end of this call
+   const uint64_t rss = Peak_RSS();
+   uint64_t seen = s.PeakRSS;
+   while (rss > seen && !s.PeakRSS.compare_exchange_weak(seen, rss)) {}
+}
+
+uint64_t CompareStats::Thread_CPU_Ns()
+{
+#if !defined(_WIN32) && defined(CLOCK_THREAD_CPUTIME_ID)
+   struct timespec ts;
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+      return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+   }
+#endif
+   return 0;
+}
+
+uint64_t CompareStats::Peak_RSS()
+{
+#ifndef _WIN32
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+   return usage.ru_maxrss;
+#else
+   return (uint64_t) usage.ru_maxrss * 1024;
+#endif
+#else
+   return 0;
+#endif
+}
+
+// Process CPU time, user and system
+static double Process_CPU_Ms()
+{
+#ifndef _WIN32
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+   return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-3;
+#else
+   return 0;
+#endif
+}
+
+static std::string JSON_String(const std::string &s)
+{
+   std::string out = "\"";
+   for (size_t i = 0; i < s.size(); i++) {
+      const unsigned char c = s[i];
+      if (c == '"' || c == '\\') {
+         out += '\\';
+         out += c;
+      } else if (c < 0x20) {
+         char esc[8];
+         sprintf(esc, "\\u%04x", c);
+         out += esc;
+      } else {
+         out += c;
+      }
+   }
+   return out + "\"";
+}
+
+// Appends printf style formatted text to out
+static void Append(std::string &out, const char *format, ...)
+{
+   char buf[512];
+   va_list ap;
+   va_start(ap, format);
+   const int n = vsnprintf(buf, sizeof(buf), format, ap);
+   va_end(ap);
+   if (n > 0) out.append(buf, n < (int) sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+std::string CompareStats::JSON(const CompareArgs &args, bool passed) const
+{
+   const double wall_ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - Start).count();
+   std::string out = "{\n";
+   if (args.ImgA && args.ImgB) {
+      out += "  \"image1\": " + JSON_String(args.ImgA->Get_Name()) + ",\n";
+      out += "  \"image2\": " + JSON_String(args.ImgB->Get_Name()) + ",\n";
+      Append(out, "  \"width\": %d,\n  \"height\": %d,\n", args.ImgA->Get_Width(),
+         args.ImgA->Get_Height());
+   }
+   Append(out, "  \"passed\": %s,\n", passed ? "true" : "false");
+   Append(out, "  \"pixels_failed\": %u,\n", args.PixelsFailed);
+   Append(out, "  \"threads\": %d,\n",
+      args.NumThreads > 0 ? args.NumThreads : ThreadPool::Hardware_Threads());
+   Append(out, "  \"wall_ms\": %.3f,\n", wall_ms);
+   Append(out, "  \"cpu_ms\": %.3f,\n", Process_CPU_Ms());
+   Append(out, "  \"peak_rss_bytes\": %llu,\n", (unsigned long long) Peak_RSS());
+   Append(out, "  \"buffer_peak_bytes\": %llu,\n", (unsigned long long) Buffer_Memory_Peak());
+   Append(out, "  \"workspace_peak_bytes\": %llu,\n", (unsigned long long) args.WorkspacePeakBytes);
+   out += "  \"stages\": {\n";
+   for (int i = 0; i < STATS_NUM_STAGES; i++) {
+      const Stage &s = Stages[i];
+      Append(out, "    \"%s\": { \"calls\": %llu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+         "\"bytes_allocated\": %llu, \"peak_rss_bytes\": %llu, \"pixels\": %llu }%s\n",
+         StageNames[i], (unsigned long long) s.Calls, s.WallNs * 1e-6, s.CpuNs * 1e-6,
+         (unsigned long long) s.Bytes, (unsigned long long) s.PeakRSS,
+         (unsigned long long) s.Pixels, i + 1 < STATS_NUM_STAGES ? "," : "");
+   }
+   out += "  }\n}\n";
+   return out;
+}
+
+bool CompareStats::Write_JSON(const char *path, const CompareArgs &args, bool passed) const
+{
+   const bool to_stdout = strcmp(path, "-") == 0;
+   FILE *f = to_stdout ? stdout : fopen(path, "w");
+   if (!f) return false;
+   const std::string json = JSON(args, passed);
+   const bool written = fwrite(json.data(), 1, json.size(), f) == json.size();
+   return (to_stdout ? fflush(f) == 0 : fclose(f) == 0) && written;
+}
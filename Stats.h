@@ -0,0 +1,106 @@
+/*
+Stats
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+class CompareArgs;
+
+// Stages of a comparison, in the order they run
+enum StatsStage
+{
+   STATS_DECODE,       // reading the image files
+   STATS_DOWNSAMPLE,
+   STATS_PREPASS,      // finding the tiles where the images differ
+   STATS_CONVERT,      // colour conversion to luminance and LAB chroma
+   STATS_PYRAMID,      // building the Laplacian pyramids
+   STATS_METRIC,       // the per-pixel test
+   STATS_WRITE,        // writing the difference image
+   STATS_NUM_STAGES
+};
+
+// Wall time, CPU time, bytes allocated and pixels processed by each stage
+// of a comparison. Stages running on several threads at once add up the
+// time of every thread. Safe to update from any thread.
+class CompareStats
+{
+public:
+   CompareStats();
+
+   void Add(StatsStage stage, uint64_t wall_ns, uint64_t cpu_ns, uint64_t bytes,
+      uint64_t pixels);
+   // The report as JSON
+   std::string JSON(const CompareArgs &args, bool passed) const;
+   // Writes the report as JSON to path, "-" being stdout
+   bool Write_JSON(const char *path, const CompareArgs &args, bool passed) const;
+
+   // CPU time of the calling thread and peak resident set size of the
+   // process, 0 where the platform cannot tell
+   static uint64_t Thread_CPU_Ns();
+   static uint64_t Peak_RSS();
+
+private:
+   CompareStats(const CompareStats&);
+   CompareStats& operator=(const CompareStats&);
+
+   struct Stage
+   {
+      std::atomic<uint64_t> Calls, WallNs, CpuNs, Bytes, Pixels, PeakRSS;
+   };
+   Stage Stages[STATS_NUM_STAGES];
+   std::chrono::steady_clock::time_point Start;
+};
+
+// Counts the enclosing scope as one call of a stage. With no stats it
+// reads no clocks, so instrumented code costs a test of the pointer.
+class StageTimer
+{
+public:
+   StageTimer(CompareStats *stats, StatsStage stage, uint64_t pixels = 0) :
+      Stats(stats), Stage(stage), Pixels(pixels), Bytes(0)
+   {
+      if (!Stats) return;
+      Start = std::chrono::steady_clock::now();
+      CpuStart = CompareStats::Thread_CPU_Ns();
+   }
+   ~StageTimer()
+   {
+      if (!Stats) return;
+      const uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - Start).count();
+      Stats->Add(Stage, wall, CompareStats::Thread_CPU_Ns() - CpuStart, Bytes, Pixels);
+   }
+   void Add_Pixels(uint64_t n) { Pixels += n; }
+   void Add_Bytes(uint64_t n) { Bytes += n; }
+
+private:
+   StageTimer(const StageTimer&);
+   StageTimer& operator=(const StageTimer&);
+
+   CompareStats *Stats;
+   StatsStage Stage;
+   uint64_t Pixels;
+   uint64_t Bytes;
+   std::chrono::steady_clock::time_point Start;
+   uint64_t CpuStart;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ThreadPool
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "ThreadPool.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+
+// The pool whose worker the current thread is, and its index there
+static thread_local const ThreadPool *WorkerPool = 0;
+static thread_local int WorkerIndex = 0;
+
+ThreadPool::ThreadPool(int num_threads) :
+   NumThreads(num_threads > 0 ? num_threads : Hardware_Threads()),
+   Stopping(false)
+{
+   // The caller of Parallel_For is the remaining thread
+   for (int i = 1; i < NumThreads; i++) {
+      Workers.push_back(std::thread(&ThreadPool::Worker_Loop, this, i));
+   }
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Stopping = true;
+   }
+   Wake.notify_all();
+   for (size_t i = 0; i < Workers.size(); i++) Workers[i].join();
+}
+
+int ThreadPool::Hardware_Threads()
+{
+   unsigned int n = std::thread::hardware_concurrency();
+   return n > 0 ? (int) n : 1;
+}
+
+void ThreadPool::Schedule(const std::function<void()> &task)
+{
+   if (Workers.empty()) {
+      task();
+      return;
+   }
+   {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Tasks.push_back(task);
+   }
+   Wake.notify_one();
+}
+
+int ThreadPool::Thread_Index() const
+{
+   return WorkerPool == this ? WorkerIndex : 0;
+}
+
+void ThreadPool::Worker_Loop(int index)
+{
+   WorkerPool = this;
+   WorkerIndex = index;
+   for (;;) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(Mutex);
+         while (!Stopping && Tasks.empty()) Wake.wait(lock);
+         if (Tasks.empty()) return;
+         task = Tasks.front();
+         Tasks.pop_front();
+      }
+      task();
+   }
+}
+
+// Bands handed out by Parallel_For. Helpers that start after the last band
+// was claimed find nothing to do, so the state is shared with them rather
+// than living on the caller's stack. Once a band throws, the bands not
+// yet started are counted as done without running and the first exception
+// is rethrown to the caller of Parallel_For.
+struct ParallelForState
+{
+   std::atomic<int> Next;
+   int Begin, End, BandSize, NumBands;
+   const std::function<void(int, int)> *Func;
+   std::mutex Mutex;
+   std::condition_variable Done;
+   int BandsDone;
+   std::atomic<bool> Failed;
+   std::exception_ptr Error;
+
+   void Run()
+   {
+      int band;
+      while ((band = Next++) < NumBands) {
+         int b = Begin + band * BandSize;
+         int e = (b + BandSize < End) ? b + BandSize : End;
+         std::exception_ptr error;
+         if (!Failed) {
+            try {
+               (*Func)(b, e);
+            } catch (...) {
+               error = std::current_exception();
+               Failed = true;
+            }
+         }
+         std::lock_guard<std::mutex> lock(Mutex);
+         if (error && !Error) Error = error;
+         if (++BandsDone == NumBands) Done.notify_all();
+      }
+   }
+};
+
+void ThreadPool::Parallel_For(int begin, int end, const std::function<void(int, int)> &func)
+{
+   if (end <= begin) return;
+   int count = end - begin;
+   if (Workers.empty() || count == 1) {
+      func(begin, end);
+      return;
+   }
+
+   // A few bands per thread keeps the load balanced when rows differ in cost
+   int bands = NumThreads * 4;
+   if (bands > count) bands = count;
+   std::shared_ptr<ParallelForState> state(new ParallelForState);
+   state->Next = 0;
+   state->Begin = begin;
+   state->End = end;
+   state->BandSize = (count + bands - 1) / bands;
+   state->NumBands = (count + state->BandSize - 1) / state->BandSize;
+   state->Func = &func;
+   state->BandsDone = 0;
+   state->Failed = false;
+
+   int helpers = NumThreads - 1;
+   if (helpers > state->NumBands - 1) helpers = state->NumBands - 1;
+   for (int i = 0; i < helpers; i++) {
+      Schedule([state]() { state->Run(); });
+   }
+   state->Run();
+
+   std::unique_lock<std::mutex> lock(state->Mutex);
+   while (state->BandsDone < state->NumBands) state->Done.wait(lock);
+   // No helper uses func any more
+   if (state->Error) std::rethrow_exception(state->Error);
+}
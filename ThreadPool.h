@@ -0,0 +1,66 @@
+/*
+ThreadPool
+Copyright (C) 2006 Yangli Hector Yee
+
+This program is free software; you can redistribute it and/or modify it under the terms of the
+GNU General Public License as published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program;
+if not, write to the Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads. The thread calling Parallel_For
+// always takes part in the work, so a pool of one thread runs everything
+// inline and nested Parallel_For calls cannot deadlock.
+class ThreadPool
+{
+public:
+   // num_threads <= 0 means one thread per hardware core
+   ThreadPool(int num_threads);
+   ~ThreadPool();
+
+   int Get_Num_Threads() const { return NumThreads; }
+   // Index of the calling thread among this pool's threads: 1 and up for
+   // its workers, 0 for any other thread, such as the caller of Parallel_For
+   int Thread_Index() const;
+
+   // Runs task on a worker thread, or inline if the pool has no workers
+   void Schedule(const std::function<void()> &task);
+
+   // Calls func(band_begin, band_end) over bands covering [begin, end)
+   // and returns once every band is done. If func throws, the remaining
+   // bands are skipped and the first exception is rethrown here.
+   void Parallel_For(int begin, int end, const std::function<void(int, int)> &func);
+
+   static int Hardware_Threads();
+
+private:
+   ThreadPool(const ThreadPool&);
+   ThreadPool& operator=(const ThreadPool&);
+
+   void Worker_Loop(int index);
+
+   int NumThreads;
+   std::vector<std::thread> Workers;
+   std::deque<std::function<void()> > Tasks;
+   std::mutex Mutex;
+   std::condition_variable Wake;
+   bool Stopping;
+};
+
+#endif